@@ -0,0 +1,99 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGNMENT (sizeof(max_align_t))
+
+
+static void free_chunks(Arena_chunk *chunk)
+{
+    while (chunk != NULL) {
+        Arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+
+//gets a chunk with room for size bytes, reusing a spare chunk if one is large enough
+static Arena_chunk *new_chunk(Arena *a, size_t size)
+{
+    Arena_chunk *chunk;
+    size_t chunk_size = size > a->chunk_size ? size : a->chunk_size;
+
+    if (a->spare != NULL && a->spare->size >= size) {
+        chunk = a->spare;
+        a->spare = chunk->next;
+    } else if ((chunk = malloc(sizeof(Arena_chunk) + chunk_size)) == NULL) {
+        return NULL;
+    } else {
+        chunk->size = chunk_size;
+    }
+    chunk->used = 0;
+    chunk->next = a->chunks;
+    a->chunks = chunk;
+
+    return chunk;
+}
+
+
+Arena *arena_create(size_t chunk_size)
+{
+    Arena *a;
+    if ((a = calloc(1, sizeof(Arena))) == NULL) {
+        return NULL;
+    }
+    a->chunk_size = chunk_size;
+
+    return a;
+}
+
+
+void arena_destroy(Arena *a)
+{
+    free_chunks(a->chunks);
+    free_chunks(a->spare);
+    free(a);
+}
+
+
+void *arena_alloc(Arena *a, size_t size)
+{
+    Arena_chunk *chunk = a->chunks;
+    void *mem;
+
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        if ((chunk = new_chunk(a, size)) == NULL) {
+            return NULL;
+        }
+    }
+    mem = (char*)chunk->data + chunk->used;
+    chunk->used += size;
+
+    return mem;
+}
+
+
+char *arena_strndup(Arena *a, const char *str, size_t len)
+{
+    char *copy;
+    if ((copy = arena_alloc(a, len + 1)) == NULL) {
+        return NULL;
+    }
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+
+void arena_reset(Arena *a)
+{
+    while (a->chunks != NULL) {
+        Arena_chunk *chunk = a->chunks;
+        a->chunks = chunk->next;
+        chunk->next = a->spare;
+        a->spare = chunk;
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/**
+ * @defgroup arena_h Arena
+ *
+ * @brief This module is used to allocate many small objects that
+ * all live until the same point in time.
+ *
+ * Allocation bumps a pointer in the current chunk, and memory is only
+ * given back in bulk, when the arena is reset or destroyed. Reset
+ * keeps the chunks, so an arena reused for the next traversal makes
+ * no calls to malloc once it has grown large enough.
+ *
+ * One arena is meant to be allocated from by one thread, but what is
+ * allocated may be used by any thread until the arena is reset.
+ *
+ */
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+
+
+/**
+ * The type for one chunk of arena memory.
+*/
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} Arena_chunk;
+
+
+/**
+ * The type for the arena.
+*/
+typedef struct arena
+{
+    Arena_chunk *chunks;        //chunk allocated from first, then the ones already full
+    Arena_chunk *spare;         //chunks kept by arena_reset for reuse
+    size_t chunk_size;
+} Arena;
+
+
+/**
+ * @brief Create and return an empty arena.
+ *
+ * @param chunk_size size in bytes of each chunk the arena grows by.
+ * @return           Arena pointer to the created arena, NULL on failure.
+ */
+Arena *arena_create(size_t chunk_size);
+
+
+/**
+ * @brief Destroys arena and everything allocated from it.
+ *
+ * @param a          Arena pointer to arena to be destroyed.
+ */
+void arena_destroy(Arena *a);
+
+
+/**
+ * @brief Allocates memory, aligned for any type, from the arena.
+ *
+ * @param a          Arena pointer to arena to allocate from.
+ * @param size       number of bytes.
+ * @return           pointer to the memory, NULL on failure.
+ */
+void *arena_alloc(Arena *a, size_t size);
+
+
+/**
+ * @brief Copies string into the arena.
+ *
+ * @param a          Arena pointer to arena to allocate from.
+ * @param str        string to copy.
+ * @param len        length of str.
+ * @return           pointer to the copy, NULL on failure.
+ */
+char *arena_strndup(Arena *a, const char *str, size_t len);
+
+
+/**
+ * @brief Gives back everything allocated from the arena at once.
+ *
+ * The chunks are kept for the next allocations.
+ *
+ * @param a          Arena pointer to arena to be reset.
+ */
+void arena_reset(Arena *a);
+
+#endif /* ARENA_H */
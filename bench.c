@@ -0,0 +1,626 @@
+/**
+ * https://github.com/schmkls/do-with-all-files
+ *
+ * Benchmark of do-with-all-files.
+ *
+ * Generates trees of known shapes in a temporary directory, the same
+ * every time, and traverses each with a sweep of thread counts, with
+ * the page cache warm and (when allowed) dropped. Every run is done in
+ * a child process, so its peak RSS is its own.
+ *
+ * How to use on Linux:
+ * 1. Run 'make bench', or 'make dwaf_bench' and then
+ *    ./dwaf_bench [-d directory] [-t max threads] [-r runs] [-x scale] [-k] [-m names | du] [-o depth | breadth | hybrid] [shape]...
+ *
+ * Explanation of arguments:
+ * [-d directory] where the trees are generated, a new directory under $TMPDIR (or /tmp) by default
+ *
+ * [-t max threads] threads are swept as 1, 2, 4... up to max threads (twice the CPUs by default),
+ *                then 0 to let the traversal tune it
+ *
+ * [-r runs] runs of each measurement, the median time is reported (3 by default)
+ *
+ * [-x scale] multiplies the number of files of every shape (1 by default, about 50000 files each)
+ *
+ * [-k] keep the generated trees, a later run with the same -d and -x reuses them
+ *                (without it only the trees and the directory made by the benchmark are removed)
+ *
+ * [-m names | du] traverse with 'do_with_all_entries' without metadata (names, the 
+ *                default) or sum the blocks of every file with 'reduce_all_entries' like du
+ *
+ * [-o depth | breadth | hybrid] order directories are read in (depth by default),
+ *                peak_rss_kb shows what it costs
+ *
+ * [shape] wide-flat, deep-chain, many-tiny, huge-dirs or mixed, all by default
+ *
+ * Output is CSV on stdout, one line per measurement:
+ *     shape,mode,order,cache,threads,files,seconds,files_per_sec,efficiency,peak_rss_kb
+ * where efficiency is files_per_sec divided by threads times files_per_sec
+ * with 1 thread (empty for the tuned thread count). Progress goes to stderr.
+ * Dropping the cache needs root, without it only warm-cache lines are printed.
+ */
+
+#define _GNU_SOURCE                 //for wait4 and mkdtemp
+#include "directory_traverser.h"
+#include "get_opts_help.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE "./dwaf_bench [-d directory] [-t max threads] [-r runs] [-x scale] [-k] [-m names | du] [-o depth | breadth | hybrid] [shape]..."
+
+#define TREE_VERSION 1                  //bumped when a shape changes, so kept trees of an older version are not reused
+#define SEED 0x5eed5eedULL
+#define MAX_THREADS 1024
+
+//a shape of tree to generate, sizes are for scale 1
+typedef struct shape {
+    const char *name;
+    bool (*generate)(const char *dir, int scale, uint64_t *rng);
+} shape;
+
+//what a child process tells about its run
+typedef struct run_result {
+    int status;
+    long files;
+    double seconds;
+} run_result;
+
+//options of one benchmark
+typedef struct bench_opts {
+    int scale;
+    int runs;
+    int max_threads;
+    bool du;
+    Dwaf_order order;
+} bench_opts;
+
+static const char *order_names[] = {"depth", "breadth", "hybrid"};     //indexed by Dwaf_order
+
+
+static uint64_t next_random(uint64_t *rng) {
+    *rng ^= *rng << 13;                 //xorshift64, the same sequence on every machine
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+
+//sets path, of PATH_MAX bytes, to dir/name, fails if it does not fit
+static bool join_path(char *path, const char *dir, const char *name) {
+    int n = snprintf(path, PATH_MAX, "%s/%s", dir, name);
+
+    if (n < 0 || n >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    return true;
+}
+
+
+//creates a file of size bytes in dir
+static bool make_file(const char *dir, const char *name, size_t size) {
+    char path[PATH_MAX];
+    static const char data[64] = "do-with-all-files benchmark file, the same in every tree ......";
+    int fd;
+    bool ok = true;
+
+    if (!join_path(path, dir, name)) {
+        return false;
+    }
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        return false;
+    }
+    if (size > 0 && write(fd, data, size < sizeof(data) ? size : sizeof(data)) < 0) {
+        ok = false;
+    }
+    close(fd);
+    return ok;
+}
+
+
+//creates sub-directory name of dir, path is set to its path
+static bool make_dir(const char *dir, const char *name, char *path) {
+    if (!join_path(path, dir, name)) {
+        return false;
+    }
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+
+//creates files_size empty files in dir
+static bool make_files(const char *dir, int files_size, size_t size) {
+    char name[32];
+
+    for (int i = 0; i < files_size; i++) {
+        snprintf(name, sizeof(name), "f%d", i);
+        if (!make_file(dir, name, size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//200 directories side by side with 250 files each
+static bool generate_wide_flat(const char *dir, int scale, uint64_t *rng) {
+    char path[PATH_MAX], name[32];
+    (void)rng;
+
+    for (int i = 0; i < 200 * scale; i++) {
+        snprintf(name, sizeof(name), "d%d", i);
+        if (!make_dir(dir, name, path) || !make_files(path, 250, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//chains of 1000 directories inside each other, with 25 files in each
+static bool generate_deep_chain(const char *dir, int scale, uint64_t *rng) {
+    char path[PATH_MAX], parent[PATH_MAX], name[32];
+    (void)rng;
+
+    for (int chain = 0; chain < 2 * scale; chain++) {
+        snprintf(name, sizeof(name), "c%d", chain);
+        if (!make_dir(dir, name, parent)) {
+            return false;
+        }
+        for (int depth = 0; depth < 1000; depth++) {
+            if (!make_files(parent, 25, 0) || !make_dir(parent, "d", path)) {
+                return false;
+            }
+            strcpy(parent, path);
+        }
+    }
+    return true;
+}
+
+
+//a tree with 8 sub-directories in every directory, 4 levels deep, and 10 files of a few bytes in each directory
+static bool generate_many_tiny_rec(const char *dir, int depth) {
+    char path[PATH_MAX], name[32];
+
+    if (!make_files(dir, 10, 16)) {
+        return false;
+    }
+    for (int i = 0; depth > 0 && i < 8; i++) {
+        snprintf(name, sizeof(name), "d%d", i);
+        if (!make_dir(dir, name, path) || !generate_many_tiny_rec(path, depth - 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool generate_many_tiny(const char *dir, int scale, uint64_t *rng) {
+    char path[PATH_MAX], name[32];
+    (void)rng;
+
+    for (int i = 0; i < scale; i++) {
+        snprintf(name, sizeof(name), "t%d", i);
+        if (!make_dir(dir, name, path) || !generate_many_tiny_rec(path, 4)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//2 directories with 25000 files each
+static bool generate_huge_dirs(const char *dir, int scale, uint64_t *rng) {
+    char path[PATH_MAX], name[32];
+    (void)rng;
+
+    for (int i = 0; i < 2; i++) {
+        snprintf(name, sizeof(name), "h%d", i);
+        if (!make_dir(dir, name, path) || !make_files(path, 25000 * scale, 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//a random tree: most directories are small, a few are large, and some branches go deep
+static bool generate_mixed_rec(const char *dir, int depth, uint64_t *rng, long *files_left) {
+    char path[PATH_MAX], name[32];
+    int files_size = (int)(next_random(rng) % 100 == 0 ? 1000 + next_random(rng) % 4000 : next_random(rng) % 40);
+    int subdirs_size = depth >= 12 ? 0 : (int)(next_random(rng) % 5);
+
+    if (files_size > *files_left) {
+        files_size = (int)*files_left;
+    }
+    *files_left -= files_size;
+    if (!make_files(dir, files_size, next_random(rng) % 64)) {
+        return false;
+    }
+    for (int i = 0; i < subdirs_size && *files_left > 0; i++) {
+        snprintf(name, sizeof(name), "m%d", i);
+        if (!make_dir(dir, name, path) || !generate_mixed_rec(path, depth + 1, rng, files_left)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool generate_mixed(const char *dir, int scale, uint64_t *rng) {
+    char path[PATH_MAX], name[32];
+    long files_left = 50000L * scale;
+
+    for (int i = 0; files_left > 0; i++) {
+        snprintf(name, sizeof(name), "r%d", i);
+        if (!make_dir(dir, name, path) || !generate_mixed_rec(path, 0, rng, &files_left)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static const shape shapes[] = {
+    {"wide-flat", generate_wide_flat},
+    {"deep-chain", generate_deep_chain},
+    {"many-tiny", generate_many_tiny},
+    {"huge-dirs", generate_huge_dirs},
+    {"mixed", generate_mixed},
+};
+#define SHAPES_SIZE ((int)(sizeof(shapes) / sizeof(shapes[0])))
+
+
+/**
+ * Generates the tree of shape under root, unless it was generated
+ * before with the same scale (a marker file is written when done).
+ *
+ * @param root directory of the benchmark
+ * @param sh shape of tree
+ * @param scale multiplier of the number of files
+ * @param tree set to the path of the tree
+ * @param built set to true if the tree is generated by this call, not kept by an earlier run
+ * @return true on success
+ */
+static bool generate_tree(const char *root, const shape *sh, int scale, char *tree, bool *built) {
+    char marker[PATH_MAX + 32], name[64];
+    uint64_t rng = SEED;
+    struct stat st;
+
+    snprintf(name, sizeof(name), "%s-x%d-v%d", sh->name, scale, TREE_VERSION);
+    snprintf(marker, sizeof(marker), "%s/%s.done", root, name);
+    if (!make_dir(root, name, tree)) {
+        return false;
+    }
+    if (stat(marker, &st) == 0) {
+        return true;
+    }
+    *built = true;
+    fprintf(stderr, "dwaf_bench: generating %s\n", tree);
+    if (!sh->generate(tree, scale, &rng)) {
+        return false;
+    }
+    return make_file(root, strrchr(marker, '/') + 1, 0);
+}
+
+
+static int remove_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st; (void)type; (void)ftw;
+    return remove(path);
+}
+
+
+//removes tree generated under root, and its marker
+static bool remove_tree(const char *tree) {
+    char marker[PATH_MAX + 8];
+
+    snprintf(marker, sizeof(marker), "%s.done", tree);
+    return nftw(tree, remove_file, 64, FTW_DEPTH | FTW_PHYS) == 0 && (remove(marker) == 0 || errno == ENOENT);
+}
+
+
+//writes out dirty pages and drops the page, dentry and inode caches, false if not allowed
+static bool drop_caches(void) {
+    int fd;
+    bool ok;
+
+    sync();
+    if ((fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC)) < 0) {
+        return false;
+    }
+    ok = write(fd, "3", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+
+static void count_entry(Dwaf_entry *entry, void *arg) {
+    (void)entry;
+    atomic_fetch_add_explicit((atomic_long*)arg, 1, memory_order_relaxed);
+}
+
+
+static void count_blocks(void *state, Dwaf_entry *entry, void *arg) {
+    long *counts = state;           //files, blocks
+    (void)arg;
+    counts[0]++;
+    counts[1] += (long)entry->stx.stx_blocks;
+}
+
+
+static void merge_counts(void *state, void *arg) {
+    long *counts = state, *total = arg;
+
+    total[0] += counts[0];
+    total[1] += counts[1];
+}
+
+
+//traverses tree in this process, and returns what it did
+static run_result run_once(char *tree, int threads, const bench_opts *opts) {
+    run_result result = {0};
+    struct timespec start, end;
+    char *files[] = {tree};
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (opts->du) {
+        Dwaf_reducer reducer = {.state_size = 2 * sizeof(long), .accumulate = count_blocks, .merge = merge_counts};
+        Dwaf_config config = {.statx_mask = STATX_BLOCKS, .order = opts->order};
+        long counts[2] = {0, 0};    //files, blocks
+        result.status = reduce_all_entries(&reducer, counts, files, 1, threads, &config);
+        result.files = counts[0];
+    } else {
+        atomic_long files_size = 0;
+        Dwaf_config config = {.statx_mask = 0, .order = opts->order};
+        result.status = do_with_all_entries(count_entry, &files_size, files, 1, threads, &config);
+        result.files = atomic_load(&files_size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return result;
+}
+
+
+/**
+ * Traverses tree in a child process, so the peak RSS measured is the
+ * traversal's alone.
+ *
+ * @param tree tree to traverse
+ * @param threads number of threads
+ * @param opts what to run
+ * @param rss_kb set to the peak RSS of the child in kilobytes
+ * @return run_result what the child did, status FAILURE if it failed
+ */
+static run_result run_in_child(char *tree, int threads, const bench_opts *opts, long *rss_kb) {
+    run_result result = {.status = FAILURE};
+    struct rusage usage;
+    int pipe_fds[2], wait_status;
+    pid_t pid;
+
+    if (pipe(pipe_fds) != 0) {
+        return result;
+    }
+    if ((pid = fork()) < 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return result;
+    }
+    if (pid == 0) {
+        run_result child_result = run_once(tree, threads, opts);
+        close(pipe_fds[0]);
+        _exit(write(pipe_fds[1], &child_result, sizeof(child_result)) == sizeof(child_result) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(pipe_fds[1]);
+    if (read(pipe_fds[0], &result, sizeof(result)) != sizeof(result)) {
+        result.status = FAILURE;
+    }
+    close(pipe_fds[0]);
+    if (wait4(pid, &wait_status, 0, &usage) != pid || !WIFEXITED(wait_status) || WEXITSTATUS(wait_status) != EXIT_SUCCESS) {
+        result.status = FAILURE;
+    }
+    *rss_kb = usage.ru_maxrss;
+    return result;
+}
+
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * Measures one point of the sweep: runs the traversal opts->runs times
+ * and prints its CSV line.
+ *
+ * @param sh shape of tree
+ * @param tree tree to traverse
+ * @param cold true to drop the caches before each run
+ * @param threads number of threads
+ * @param opts benchmark options
+ * @param base_rate files per second with 1 thread, not used when threads is 1
+ * @return double files per second, negative on failure
+ */
+static double measure(const shape *sh, char *tree, bool cold, int threads, const bench_opts *opts, double base_rate) {
+    double seconds[opts->runs];
+    long files = 0, rss_kb, max_rss_kb = 0;
+    double median, rate;
+
+    for (int i = 0; i < opts->runs; i++) {
+        run_result result;
+        if (cold && !drop_caches()) {
+            return -1;
+        }
+        result = run_in_child(tree, threads, opts, &rss_kb);
+        if (result.status != SUCCESS) {
+            fprintf(stderr, "dwaf_bench: traversal of '%s' with %d threads failed\n", tree, threads);
+            return -1;
+        }
+        if (files != 0 && result.files != files) {
+            fprintf(stderr, "dwaf_bench: traversals of '%s' found %ld and %ld files\n", tree, files, result.files);
+            return -1;
+        }
+        files = result.files;
+        seconds[i] = result.seconds;
+        max_rss_kb = rss_kb > max_rss_kb ? rss_kb : max_rss_kb;
+    }
+    qsort(seconds, opts->runs, sizeof(double), compare_doubles);
+    median = seconds[opts->runs / 2];
+    rate = median > 0 ? files / median : 0;
+
+    printf("%s,%s,%s,%s,%d,%ld,%.6f,%.0f,", sh->name, opts->du ? "du" : "names", order_names[opts->order], 
+            cold ? "cold" : "warm", threads, files, median, rate);
+    if (threads == 1) {
+        base_rate = rate;
+    }
+    if (threads > 0 && base_rate > 0) {
+        printf("%.3f", rate / (threads * base_rate));
+    }
+    printf(",%ld\n", max_rss_kb);
+    fflush(stdout);
+    return rate;
+}
+
+
+//measures the sweep of thread counts on tree, returns false on failure
+static bool bench_tree(const shape *sh, char *tree, bool cold, const bench_opts *opts) {
+    long rss_kb;
+    double base_rate = 0, rate;
+
+    if (!cold) {
+        run_in_child(tree, 1, opts, &rss_kb);       //warms the cache
+    }
+    for (int threads = 1; threads <= opts->max_threads; threads *= 2) {
+        fprintf(stderr, "dwaf_bench: %s, %s cache, %d threads\n", sh->name, cold ? "cold" : "warm", threads);
+        if ((rate = measure(sh, tree, cold, threads, opts, base_rate)) < 0) {
+            return false;
+        }
+        if (threads == 1) {
+            base_rate = rate;
+        }
+    }
+    fprintf(stderr, "dwaf_bench: %s, %s cache, tuned threads\n", sh->name, cold ? "cold" : "warm");
+    return measure(sh, tree, cold, DWAF_ADAPTIVE_THREADS, opts, base_rate) >= 0;
+}
+
+
+int main(int argc, char **argv) {
+    bench_opts opts = {.scale = 1, .runs = 3, .max_threads = 0, .du = false, .order = DWAF_DEPTH_FIRST};
+    char root[PATH_MAX] = "", tree[PATH_MAX];
+    bool keep = false, made_root = false, can_drop, selected[SHAPES_SIZE];
+    int exit_status = EXIT_SUCCESS, opt;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "d:t:r:x:km:o:")) != -1) {
+        switch (opt) {
+            case 'd':
+                snprintf(root, sizeof(root), "%s", optarg);
+                break;
+            case 't':
+            case 'r':
+            case 'x':
+                if (!is_number_above(optarg, 0)) {
+                    fprintf(stderr, "dwaf_bench: -%c should be a positive integer\n", opt);
+                    exit(EXIT_FAILURE);
+                }
+                *(opt == 't' ? &opts.max_threads : opt == 'r' ? &opts.runs : &opts.scale) = atoi(optarg);
+                break;
+            case 'k':
+                keep = true;
+                break;
+            case 'm':
+                if (strcmp(optarg, "du") != 0 && strcmp(optarg, "names") != 0) {
+                    fprintf(stderr, "dwaf_bench: How to use the benchmark: " USAGE "\n");
+                    exit(EXIT_FAILURE);
+                }
+                opts.du = strcmp(optarg, "du") == 0;
+                break;
+            case 'o':
+                for (opts.order = DWAF_DEPTH_FIRST; opts.order <= DWAF_HYBRID; opts.order++) {
+                    if (strcmp(optarg, order_names[opts.order]) == 0) {
+                        break;
+                    }
+                }
+                if (opts.order > DWAF_HYBRID) {
+                    fprintf(stderr, "dwaf_bench: How to use the benchmark: " USAGE "\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "dwaf_bench: How to use the benchmark: " USAGE "\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (opts.max_threads == 0) {
+        opts.max_threads = cpus > 0 ? 2 * (int)cpus : 8;
+    }
+    if (opts.max_threads > MAX_THREADS) {
+        opts.max_threads = MAX_THREADS;
+    }
+    for (int i = 0; i < SHAPES_SIZE; i++) {
+        selected[i] = optind == argc;
+    }
+    for (int i = optind; i < argc; i++) {
+        int found = -1;
+        for (int j = 0; j < SHAPES_SIZE; j++) {
+            if (strcmp(argv[i], shapes[j].name) == 0) {
+                found = j;
+            }
+        }
+        if (found < 0) {
+            fprintf(stderr, "dwaf_bench: unknown shape '%s'\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        selected[found] = true;
+    }
+
+    if (root[0] == '\0') {
+        const char *tmp = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+        snprintf(root, sizeof(root), "%s/dwaf_bench.XXXXXX", tmp);
+        if (mkdtemp(root) == NULL) {
+            perror("dwaf_bench: mkdtemp");
+            exit(EXIT_FAILURE);
+        }
+        made_root = true;
+    } else if (mkdir(root, 0755) != 0 && errno != EEXIST) {
+        perror("dwaf_bench: mkdir");
+        exit(EXIT_FAILURE);
+    }
+    if (!(can_drop = drop_caches())) {
+        fprintf(stderr, "dwaf_bench: can not drop caches (needs root), only warm caches are measured\n");
+    }
+
+    printf("shape,mode,order,cache,threads,files,seconds,files_per_sec,efficiency,peak_rss_kb\n");
+    for (int i = 0; i < SHAPES_SIZE && exit_status == EXIT_SUCCESS; i++) {
+        if (!selected[i]) {
+            continue;
+        }
+        bool built = false;
+        if (!generate_tree(root, &shapes[i], opts.scale, tree, &built)) {
+            fprintf(stderr, "dwaf_bench: can not generate '%s' in '%s'\n", shapes[i].name, root);
+            exit_status = EXIT_FAILURE;
+        } else if (!bench_tree(&shapes[i], tree, false, &opts) || (can_drop && !bench_tree(&shapes[i], tree, true, &opts))) {
+            exit_status = EXIT_FAILURE;
+        }
+        if (!keep && built && !remove_tree(tree)) {     //a tree kept by an earlier run is left for the next
+            fprintf(stderr, "dwaf_bench: can not remove '%s'\n", tree);
+        }
+    }
+
+    if (keep) {
+        fprintf(stderr, "dwaf_bench: trees kept in '%s'\n", root);
+    } else if (made_root && rmdir(root) != 0) {
+        fprintf(stderr, "dwaf_bench: can not remove '%s'\n", root);
+    }
+    return exit_status;
+}
@@ -0,0 +1,524 @@
+#define _GNU_SOURCE                 //for statx
+#include "dir_cache.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#define DIR_CACHE_MAGIC "DWAFDC1"
+#define COPY_BUF_SIZE (1024 * 1024)
+#define SPOOL_BUF_SIZE (256 * 1024)
+
+
+//start of the cache file
+typedef struct cache_header {
+    char magic[8];
+    uint64_t dirs_size;
+    uint64_t index_offset;      //index of dirs_size keys, sorted by device and inode
+} Cache_header;
+
+//where the record of a directory is in the cache file
+typedef struct cache_key {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t offset;
+} Cache_key;
+
+struct dir_cache {
+    void *map;
+    size_t size;
+    const Cache_key *index;
+    uint64_t dirs_size;
+    uint64_t index_offset;
+};
+
+//the records written by one thread
+typedef struct cache_part {
+    FILE *spool;                //unlinked temporary file the records are written to, opened on first record
+    uint64_t spooled;           //bytes written to spool
+    Cache_key *keys;            //offsets are relative to the start of spool
+    size_t keys_size;
+    size_t keys_capacity;
+    bool failed;
+
+    bool started;               //a record is being built
+    Cache_dir dir;
+    Cache_entry *entries;
+    size_t entries_capacity;
+    char *names;
+    size_t names_used;
+    size_t names_capacity;
+} Cache_part;
+
+struct cache_writer {
+    char *path;
+    Cache_part **parts;         //allocated one by one, so threads do not share cache lines
+    int parts_size;
+    int64_t start_sec;
+};
+
+
+static size_t pad8(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+
+static size_t record_size(const Cache_dir *dir)
+{
+    return sizeof(Cache_dir) + dir->entries_size * sizeof(Cache_entry) + dir->names_size;
+}
+
+
+static int compare_keys(const void *a, const void *b)
+{
+    const Cache_key *ka = a, *kb = b;
+    if (ka->dev != kb->dev) {
+        return ka->dev < kb->dev ? -1 : 1;
+    }
+    if (ka->ino != kb->ino) {
+        return ka->ino < kb->ino ? -1 : 1;
+    }
+    return 0;
+}
+
+
+Dir_cache *dir_cache_open(const char *path)
+{
+    Dir_cache *cache;
+    const Cache_header *header;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Cache_header) || (cache = calloc(1, sizeof(Dir_cache))) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    cache->size = (size_t)st.st_size;
+    cache->map = mmap(NULL, cache->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cache->map == MAP_FAILED) {
+        free(cache);
+        return NULL;
+    }
+
+    header = cache->map;
+    if (memcmp(header->magic, DIR_CACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->index_offset % 8 != 0 || header->index_offset > cache->size
+            || header->dirs_size > (cache->size - header->index_offset) / sizeof(Cache_key)) {
+        dir_cache_close(cache);
+        return NULL;
+    }
+    cache->dirs_size = header->dirs_size;
+    cache->index_offset = header->index_offset;
+    cache->index = (const Cache_key*)((const char*)cache->map + header->index_offset);
+    madvise(cache->map, cache->size, MADV_RANDOM);
+
+    return cache;
+}
+
+
+void dir_cache_close(Dir_cache *cache)
+{
+    munmap(cache->map, cache->size);
+    free(cache);
+}
+
+
+//checks that record lies within the records of the cache and that its names are terminated
+static bool is_valid_record(Dir_cache *cache, uint64_t offset)
+{
+    const Cache_dir *dir;
+    const Cache_entry *entries;
+    const char *names;
+
+    if (offset % 8 != 0 || offset < sizeof(Cache_header) || offset + sizeof(Cache_dir) > cache->index_offset) {
+        return false;
+    }
+    dir = (const Cache_dir*)((const char*)cache->map + offset);
+    if (dir->entries_size > (cache->index_offset - offset - sizeof(Cache_dir)) / sizeof(Cache_entry)
+            || record_size(dir) > cache->index_offset - offset) {
+        return false;
+    }
+    entries = dir_cache_entries(dir);
+    names = (const char*)(entries + dir->entries_size);
+    if (dir->names_size > 0 && names[dir->names_size - 1] != '\0') {
+        return false;
+    }
+    for (uint32_t i = 0; i < dir->entries_size; i++) {
+        if (entries[i].name_offset >= dir->names_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//a record is valid while the directory's times are the same as when it was read
+static bool is_fresh(const Cache_dir *dir, const struct statx *stx, unsigned int mask)
+{
+    return dir->mtime_sec == stx->stx_mtime.tv_sec && dir->mtime_nsec == stx->stx_mtime.tv_nsec
+            && dir->ctime_sec == stx->stx_ctime.tv_sec && dir->ctime_nsec == stx->stx_ctime.tv_nsec
+            && (mask & ~dir->stx_mask) == 0;
+}
+
+
+const Cache_dir *dir_cache_find(Dir_cache *cache, const struct statx *stx, unsigned int mask)
+{
+    Cache_key key = {.dev = makedev(stx->stx_dev_major, stx->stx_dev_minor), .ino = stx->stx_ino};
+    const Cache_key *found;
+    const Cache_dir *dir;
+
+    if ((found = bsearch(&key, cache->index, cache->dirs_size, sizeof(Cache_key), compare_keys)) == NULL
+            || !is_valid_record(cache, found->offset)) {
+        return NULL;
+    }
+    dir = (const Cache_dir*)((const char*)cache->map + found->offset);
+    return is_fresh(dir, stx, mask) ? dir : NULL;
+}
+
+
+const Cache_entry *dir_cache_entries(const Cache_dir *dir)
+{
+    return (const Cache_entry*)(dir + 1);
+}
+
+
+const char *dir_cache_name(const Cache_dir *dir, const Cache_entry *entry)
+{
+    return (const char*)(dir_cache_entries(dir) + dir->entries_size) + entry->name_offset;
+}
+
+
+void dir_cache_entry_statx(const Cache_entry *entry, struct statx *stx)
+{
+    memset(stx, 0, sizeof(*stx));
+    stx->stx_mask = entry->stx_mask;
+    stx->stx_ino = entry->ino;
+    stx->stx_size = entry->size;
+    stx->stx_blocks = entry->blocks;
+    stx->stx_mtime.tv_sec = entry->mtime_sec;
+    stx->stx_mtime.tv_nsec = entry->mtime_nsec;
+    stx->stx_mode = (uint16_t)entry->mode;
+    stx->stx_uid = entry->uid;
+    stx->stx_gid = entry->gid;
+    stx->stx_nlink = entry->nlink;
+}
+
+
+
+//------------------------------writing--------------------------------//
+
+Cache_writer *cache_writer_create(const char *path, int parts_size)
+{
+    Cache_writer *w;
+
+    if ((w = calloc(1, sizeof(Cache_writer))) == NULL) {
+        return NULL;
+    }
+    w->parts_size = parts_size;
+    w->start_sec = (int64_t)time(NULL);
+    if ((w->path = strdup(path)) == NULL || (w->parts = calloc(parts_size, sizeof(Cache_part*))) == NULL) {
+        cache_writer_destroy(w);
+        return NULL;
+    }
+    for (int i = 0; i < parts_size; i++) {
+        if ((w->parts[i] = calloc(1, sizeof(Cache_part))) == NULL) {
+            cache_writer_destroy(w);
+            return NULL;
+        }
+    }
+    return w;
+}
+
+
+void cache_writer_destroy(Cache_writer *w)
+{
+    if (w->parts != NULL) {
+        for (int i = 0; i < w->parts_size; i++) {
+            Cache_part *part = w->parts[i];
+            if (part == NULL) {
+                continue;
+            }
+            if (part->spool != NULL) {
+                fclose(part->spool);
+            }
+            free(part->keys);
+            free(part->entries);
+            free(part->names);
+            free(part);
+        }
+        free(w->parts);
+    }
+    free(w->path);
+    free(w);
+}
+
+
+//opens a temporary file next to the cache file, unlinked so it goes away with the process
+static FILE *open_temp(const char *path, bool unlinked, char **temp_path)
+{
+    size_t len = strlen(path) + sizeof(".XXXXXX");
+    char *template;
+    FILE *file;
+    int fd;
+
+    if ((template = malloc(len)) == NULL) {
+        return NULL;
+    }
+    snprintf(template, len, "%s.XXXXXX", path);
+    if ((fd = mkostemp(template, O_CLOEXEC)) < 0) {
+        free(template);
+        return NULL;
+    }
+    if (unlinked) {
+        unlink(template);
+    }
+    if ((file = fdopen(fd, unlinked ? "w+" : "w")) == NULL) {
+        close(fd);
+        if (!unlinked) {
+            unlink(template);
+        }
+        free(template);
+        return NULL;
+    }
+    if (temp_path != NULL) {
+        *temp_path = template;
+    } else {
+        free(template);
+    }
+    return file;
+}
+
+
+//adds record made of head, entries and names to part
+static void spool_record(Cache_writer *w, Cache_part *part, const Cache_dir *head, 
+                        const void *entries, size_t entries_bytes, const void *names, size_t names_size)
+{
+    if (part->spool == NULL) {
+        if ((part->spool = open_temp(w->path, true, NULL)) == NULL) {
+            part->failed = true;
+            return;
+        }
+        setvbuf(part->spool, NULL, _IOFBF, SPOOL_BUF_SIZE);
+    }
+    if (part->keys_size == part->keys_capacity) {
+        size_t capacity = part->keys_capacity == 0 ? 1024 : part->keys_capacity * 2;
+        Cache_key *grown;
+        if ((grown = realloc(part->keys, capacity * sizeof(Cache_key))) == NULL) {
+            part->failed = true;
+            return;
+        }
+        part->keys = grown;
+        part->keys_capacity = capacity;
+    }
+    if (fwrite(head, sizeof(Cache_dir), 1, part->spool) != 1
+            || (entries_bytes > 0 && fwrite(entries, entries_bytes, 1, part->spool) != 1)
+            || (names_size > 0 && fwrite(names, names_size, 1, part->spool) != 1)) {
+        part->failed = true;
+        return;
+    }
+    part->keys[part->keys_size].dev = head->dev;
+    part->keys[part->keys_size].ino = head->ino;
+    part->keys[part->keys_size].offset = part->spooled;
+    part->keys_size++;
+    part->spooled += sizeof(Cache_dir) + entries_bytes + names_size;
+}
+
+
+void cache_writer_begin_dir(Cache_writer *w, int part_index, const struct statx *stx, unsigned int mask)
+{
+    Cache_part *part = w->parts[part_index];
+
+    memset(&part->dir, 0, sizeof(Cache_dir));
+    part->dir.dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    part->dir.ino = stx->stx_ino;
+    part->dir.mtime_sec = stx->stx_mtime.tv_sec;
+    part->dir.mtime_nsec = stx->stx_mtime.tv_nsec;
+    part->dir.ctime_sec = stx->stx_ctime.tv_sec;
+    part->dir.ctime_nsec = stx->stx_ctime.tv_nsec;
+    part->dir.stx_mask = mask;
+    part->names_used = 0;
+    part->started = true;
+}
+
+
+void cache_writer_add_entry(Cache_writer *w, int part_index, const char *name, unsigned char d_type, 
+                            unsigned int stx_mask, const struct statx *stx)
+{
+    Cache_part *part = w->parts[part_index];
+    size_t name_len = strlen(name) + 1;
+    Cache_entry *entry;
+
+    if (!part->started) {
+        return;
+    }
+    if (part->dir.entries_size == part->entries_capacity) {
+        size_t capacity = part->entries_capacity == 0 ? 256 : part->entries_capacity * 2;
+        Cache_entry *grown;
+        if ((grown = realloc(part->entries, capacity * sizeof(Cache_entry))) == NULL) {
+            part->started = false;          //record is dropped, the directory is read again next time
+            return;
+        }
+        part->entries = grown;
+        part->entries_capacity = capacity;
+    }
+    if (part->names_used + name_len + 8 > part->names_capacity) {
+        size_t capacity = part->names_capacity == 0 ? 4096 : part->names_capacity;
+        char *grown;
+        while (capacity < part->names_used + name_len + 8) {
+            capacity *= 2;
+        }
+        if ((grown = realloc(part->names, capacity)) == NULL) {
+            part->started = false;
+            return;
+        }
+        part->names = grown;
+        part->names_capacity = capacity;
+    }
+
+    entry = &part->entries[part->dir.entries_size++];
+    memset(entry, 0, sizeof(Cache_entry));
+    entry->stx_mask = stx_mask & DIR_CACHE_STATX_MASK;
+    entry->d_type = d_type;
+    entry->name_offset = (uint32_t)part->names_used;
+    memcpy(part->names + part->names_used, name, name_len);
+    part->names_used += name_len;
+    if (entry->stx_mask == 0) {
+        return;
+    }
+    entry->ino = stx->stx_ino;
+    entry->size = stx->stx_size;
+    entry->blocks = stx->stx_blocks;
+    entry->mtime_sec = stx->stx_mtime.tv_sec;
+    entry->mtime_nsec = stx->stx_mtime.tv_nsec;
+    entry->mode = stx->stx_mode;
+    entry->uid = stx->stx_uid;
+    entry->gid = stx->stx_gid;
+    entry->nlink = stx->stx_nlink;
+}
+
+
+void cache_writer_end_dir(Cache_writer *w, int part_index, bool keep)
+{
+    Cache_part *part = w->parts[part_index];
+    size_t entries_bytes = part->dir.entries_size * sizeof(Cache_entry);
+    size_t names_size = pad8(part->names_used);
+
+    //a directory changed in the same second it was read, or later, could change again without its times telling
+    if (part->started && keep && part->dir.ctime_sec + 1 < w->start_sec && part->dir.mtime_sec + 1 < w->start_sec) {
+        if (names_size > part->names_used) {
+            memset(part->names + part->names_used, 0, names_size - part->names_used);
+        }
+        part->dir.names_size = (uint32_t)names_size;
+        spool_record(w, part, &part->dir, part->entries, entries_bytes, part->names, names_size);
+    }
+    part->started = false;
+    part->dir.entries_size = 0;
+}
+
+
+void cache_writer_copy_dir(Cache_writer *w, int part_index, const Cache_dir *dir)
+{
+    spool_record(w, w->parts[part_index], dir, dir + 1, record_size(dir) - sizeof(Cache_dir), NULL, 0);
+}
+
+
+//copies the spooled records of part to the end of file
+static bool copy_part(Cache_part *part, FILE *file, char *buf)
+{
+    size_t read_bytes;
+
+    if (part->spool == NULL) {
+        return true;
+    }
+    if (fflush(part->spool) != 0 || fseek(part->spool, 0, SEEK_SET) != 0) {
+        return false;
+    }
+    while ((read_bytes = fread(buf, 1, COPY_BUF_SIZE, part->spool)) > 0) {
+        if (fwrite(buf, 1, read_bytes, file) != read_bytes) {
+            return false;
+        }
+    }
+    return !ferror(part->spool);
+}
+
+
+//writes header, the parts' records and the index to file, index is filled in with the keys of all parts
+static bool write_cache(Cache_writer *w, FILE *file, Cache_key *index, size_t dirs_size, char *buf)
+{
+    Cache_header header;
+    uint64_t offset = sizeof(Cache_header);
+    size_t at = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DIR_CACHE_MAGIC, sizeof(header.magic));
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    for (int i = 0; i < w->parts_size; i++) {
+        Cache_part *part = w->parts[i];
+        if (!copy_part(part, file, buf)) {
+            return false;
+        }
+        for (size_t k = 0; k < part->keys_size; k++) {
+            index[at] = part->keys[k];
+            index[at++].offset += offset;
+        }
+        offset += part->spooled;
+    }
+    qsort(index, dirs_size, sizeof(Cache_key), compare_keys);
+
+    header.dirs_size = dirs_size;
+    header.index_offset = offset;
+    return (dirs_size == 0 || fwrite(index, sizeof(Cache_key), dirs_size, file) == dirs_size)
+            && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1
+            && fflush(file) == 0 && fsync(fileno(file)) == 0;
+}
+
+
+bool cache_writer_commit(Cache_writer *w)
+{
+    Cache_key *index;
+    size_t dirs_size = 0;
+    char *temp_path = NULL, *buf;
+    FILE *file;
+    bool ok;
+
+    for (int i = 0; i < w->parts_size; i++) {
+        if (w->parts[i]->failed) {
+            return false;
+        }
+        dirs_size += w->parts[i]->keys_size;
+    }
+    if ((index = malloc((dirs_size > 0 ? dirs_size : 1) * sizeof(Cache_key))) == NULL) {
+        return false;
+    }
+    if ((buf = malloc(COPY_BUF_SIZE)) == NULL || (file = open_temp(w->path, false, &temp_path)) == NULL) {
+        free(buf);
+        free(index);
+        return false;
+    }
+
+    ok = write_cache(w, file, index, dirs_size, buf);
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (ok && rename(temp_path, w->path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    free(index);
+    free(buf);
+    return ok;
+}
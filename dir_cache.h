@@ -0,0 +1,230 @@
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+/**
+ * @defgroup dir_cache_h Directory cache
+ *
+ * @brief This module is used to remember the entries of directories
+ * between traversals, so directories that did not change do not have
+ * to be read again.
+ *
+ * A cache file holds one record per directory: the directory's device,
+ * inode, modification and change times, and its entries' names, types
+ * and (some of their) metadata. A record is only valid while the
+ * directory's times are the same as when it was read. Note that
+ * changing a file in place does not change its directory's times, so
+ * the metadata of such a file is replayed as it was when cached.
+ *
+ * A cache is read by mapping the file into memory, and records are
+ * found by binary search in the index at the end of the file.
+ *
+ * A new cache is written in parts, one per thread, so no locks are
+ * needed while traversing. Each part is spooled to a temporary file,
+ * and the parts are joined into the cache file when committed. The
+ * file is replaced atomically, so readers never see half a cache.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <linux/stat.h>
+
+/**
+ * The STATX_* fields a cache can hold of each entry.
+*/
+#define DIR_CACHE_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID \
+                                | STATX_MTIME | STATX_INO | STATX_SIZE | STATX_BLOCKS)
+
+/**
+ * The STATX_* fields of a directory that tell if its record is valid.
+*/
+#define DIR_CACHE_STAMP_MASK (STATX_INO | STATX_MTIME | STATX_CTIME)
+
+
+/**
+ * The type for the record of one directory, as stored in the cache file.
+ * Followed by entries_size Cache_entry and names_size bytes of names.
+*/
+typedef struct cache_dir
+{
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t ctime_sec;
+    uint32_t mtime_nsec;
+    uint32_t ctime_nsec;
+    uint32_t stx_mask;          //STATX_* fields fetched for the entries when the directory was read
+    uint32_t entries_size;
+    uint32_t names_size;        //padded, so the next record is aligned
+    uint32_t pad;
+} Cache_dir;
+
+
+/**
+ * The type for one entry of a directory record.
+*/
+typedef struct cache_entry
+{
+    uint64_t ino;
+    uint64_t size;
+    uint64_t blocks;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t nlink;
+    uint32_t stx_mask;          //STATX_* fields of the entry that are held
+    uint32_t name_offset;       //offset of name in the names of the record
+    uint8_t d_type;
+    uint8_t pad[3];
+} Cache_entry;
+
+
+/**
+ * The type for a cache that is read.
+*/
+typedef struct dir_cache Dir_cache;
+
+
+/**
+ * The type for a cache that is written.
+*/
+typedef struct cache_writer Cache_writer;
+
+
+/**
+ * @brief Opens cache file for reading.
+ *
+ * @param path       path of cache file.
+ * @return           Dir_cache pointer to the opened cache, NULL if the
+ *                   file does not exist or is not a valid cache.
+ */
+Dir_cache *dir_cache_open(const char *path);
+
+
+/**
+ * @brief Closes cache, its records are no longer valid.
+ *
+ * @param cache      Dir_cache pointer to cache to be closed.
+ */
+void dir_cache_close(Dir_cache *cache);
+
+
+/**
+ * @brief Finds the record of a directory, if it is still valid and holds the wanted metadata.
+ *
+ * @param cache      Dir_cache pointer to cache.
+ * @param stx        directory's statx with at least the DIR_CACHE_STAMP_MASK fields.
+ * @param mask       STATX_* fields wanted of the entries.
+ * @return           pointer to the record, NULL if the directory has to be read.
+ */
+const Cache_dir *dir_cache_find(Dir_cache *cache, const struct statx *stx, unsigned int mask);
+
+
+/**
+ * @brief Returns the entries of record.
+ *
+ * @param dir        record of directory.
+ * @return           array of dir->entries_size entries.
+ */
+const Cache_entry *dir_cache_entries(const Cache_dir *dir);
+
+
+/**
+ * @brief Returns the name of an entry of record.
+ *
+ * @param dir        record of directory.
+ * @param entry      one of the record's entries.
+ * @return           name of entry.
+ */
+const char *dir_cache_name(const Cache_dir *dir, const Cache_entry *entry);
+
+
+/**
+ * @brief Fills in statx buffer with the metadata held of entry.
+ *
+ * @param entry      entry of record.
+ * @param stx        buffer to fill in, stx_mask tells the fields held.
+ */
+void dir_cache_entry_statx(const Cache_entry *entry, struct statx *stx);
+
+
+/**
+ * @brief Create and return a writer of a new cache.
+ *
+ * Directories whose times are too close to the start of the writer
+ * are not written, since they may change again without the times
+ * telling.
+ *
+ * @param path       path of cache file to be written by cache_writer_commit.
+ * @param parts_size number of parts, one for each thread that writes.
+ * @return           Cache_writer pointer to the created writer, NULL on failure.
+ */
+Cache_writer *cache_writer_create(const char *path, int parts_size);
+
+
+/**
+ * @brief Destroys writer, without writing the cache if it was not committed.
+ *
+ * @param w          Cache_writer pointer to writer to be destroyed.
+ */
+void cache_writer_destroy(Cache_writer *w);
+
+
+/**
+ * @brief Starts the record of a directory in a part.
+ *
+ * @param w          Cache_writer pointer to writer.
+ * @param part       part written by the calling thread.
+ * @param stx        directory's statx with at least the DIR_CACHE_STAMP_MASK fields.
+ * @param mask       STATX_* fields fetched for the entries.
+ */
+void cache_writer_begin_dir(Cache_writer *w, int part, const struct statx *stx, unsigned int mask);
+
+
+/**
+ * @brief Adds an entry to the started record of a part.
+ *
+ * @param w          Cache_writer pointer to writer.
+ * @param part       part written by the calling thread.
+ * @param name       name of entry.
+ * @param d_type     DT_* type of entry.
+ * @param stx_mask   STATX_* fields of stx that were fetched, 0 if entry was not stat:ed.
+ * @param stx        metadata of entry.
+ */
+void cache_writer_add_entry(Cache_writer *w, int part, const char *name, unsigned char d_type, 
+                            unsigned int stx_mask, const struct statx *stx);
+
+
+/**
+ * @brief Ends the started record of a part.
+ *
+ * @param w          Cache_writer pointer to writer.
+ * @param part       part written by the calling thread.
+ * @param keep       false if the directory could not be read fully, the record is then dropped.
+ */
+void cache_writer_end_dir(Cache_writer *w, int part, bool keep);
+
+
+/**
+ * @brief Copies a record of a read cache, of a directory that did not change, to a part.
+ *
+ * @param w          Cache_writer pointer to writer.
+ * @param part       part written by the calling thread.
+ * @param dir        record to copy.
+ */
+void cache_writer_copy_dir(Cache_writer *w, int part, const Cache_dir *dir);
+
+
+/**
+ * @brief Joins the parts into the cache file, which is replaced atomically.
+ *
+ * @param w          Cache_writer pointer to writer.
+ * @return           true on success, false on failure.
+ */
+bool cache_writer_commit(Cache_writer *w);
+
+#endif /* DIR_CACHE_H */
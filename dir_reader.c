@@ -0,0 +1,127 @@
+#include "dir_reader.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <dirent.h>
+#endif
+
+
+#ifdef __linux__
+//record layout written by getdents64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+
+Dir_reader *dir_reader_create(size_t buf_size)
+{
+    Dir_reader *dr;
+    if ((dr = calloc(1, sizeof(Dir_reader))) == NULL) {
+        return NULL;
+    }
+    if ((dr->buf = malloc(buf_size)) == NULL) {
+        free(dr);
+        return NULL;
+    }
+    dr->size = buf_size;
+    dr->fd = -1;
+
+    return dr;
+}
+
+
+void dir_reader_destroy(Dir_reader *dr)
+{
+    dir_reader_close(dr);
+    free(dr->buf);
+    free(dr);
+}
+
+
+bool dir_reader_open(Dir_reader *dr, int fd)
+{
+    dr->pos = 0;
+    dr->end = 0;
+#ifdef __linux__
+    dr->fd = fd;
+#else
+    int dir_fd;
+    if ((dir_fd = dup(fd)) < 0) {
+        return false;
+    }
+    if ((dr->dir = fdopendir(dir_fd)) == NULL) {
+        close(dir_fd);
+        return false;
+    }
+    dr->fd = fd;
+#endif
+    return true;
+}
+
+
+int dir_reader_next(Dir_reader *dr, Dir_entry *entry)
+{
+#ifdef __linux__
+    struct linux_dirent64 *record;
+
+    if (dr->pos >= dr->end) {
+        long read_bytes = syscall(SYS_getdents64, dr->fd, dr->buf, dr->size);
+        if (read_bytes < 0) {
+            return -1;
+        }
+        if (read_bytes == 0) {
+            return 0;
+        }
+        dr->pos = 0;
+        dr->end = (size_t)read_bytes;
+    }
+
+    record = (struct linux_dirent64*)(dr->buf + dr->pos);
+    dr->pos += record->d_reclen;
+
+    entry->name = record->d_name;
+    entry->type = record->d_type;
+    entry->ino = (ino_t)record->d_ino;
+    return 1;
+#else
+    struct dirent *dir_pointer;
+
+    if ((dir_pointer = readdir(dr->dir)) == NULL) {
+        return 0;
+    }
+    entry->name = dir_pointer->d_name;
+    entry->type = dir_pointer->d_type;
+    entry->ino = dir_pointer->d_ino;
+    return 1;
+#endif
+}
+
+
+bool dir_reader_refills(const Dir_reader *dr)
+{
+#ifdef __linux__
+    return dr->pos >= dr->end;
+#else
+    (void)dr;
+    return true;                //readdir is not told apart from its own buffering
+#endif
+}
+
+
+void dir_reader_close(Dir_reader *dr)
+{
+#ifndef __linux__
+    if (dr->dir != NULL) {
+        closedir(dr->dir);
+        dr->dir = NULL;
+    }
+#endif
+    dr->fd = -1;
+}
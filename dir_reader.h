@@ -0,0 +1,114 @@
+#ifndef DIR_READER_H
+#define DIR_READER_H
+
+/**
+ * @defgroup dir_reader_h Directory reader
+ *
+ * @brief This module is used to read the entries of open directories.
+ *
+ * On Linux the entries are read with the getdents64 system call
+ * straight into a large buffer that is reused for every directory,
+ * and entry names are handed out as pointers into that buffer.
+ * Elsewhere readdir is used.
+ *
+ * One reader is meant to be owned by one thread.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#ifndef __linux__
+#include <dirent.h>
+#endif
+
+#define DIR_READER_BUF_SIZE (256 * 1024)
+
+
+/**
+ * The type for one directory entry. The name is only valid until
+ * the next entry is read.
+*/
+typedef struct dir_entry
+{
+    const char *name;
+    unsigned char type;         //DT_* constant, DT_UNKNOWN if not known
+    ino_t ino;
+} Dir_entry;
+
+
+/**
+ * The type for the directory reader.
+*/
+typedef struct dir_reader
+{
+    int fd;
+    char *buf;
+    size_t size;
+    size_t pos;                 //offset of next entry in buf
+    size_t end;                 //number of bytes in buf
+#ifndef __linux__
+    DIR *dir;
+#endif
+} Dir_reader;
+
+
+/**
+ * @brief Create and return a directory reader.
+ *
+ * @param buf_size   size in bytes of the buffer entries are read into.
+ * @return           Dir_reader pointer to the created reader, NULL on failure.
+ */
+Dir_reader *dir_reader_create(size_t buf_size);
+
+
+/**
+ * @brief Destroys directory reader.
+ *
+ * @param dr         Dir_reader pointer to reader to be destroyed.
+ */
+void dir_reader_destroy(Dir_reader *dr);
+
+
+/**
+ * @brief Starts reading an open directory.
+ *
+ * The reader does not take over the file descriptor, it is
+ * still to be closed by the caller.
+ *
+ * @param dr         Dir_reader pointer to reader.
+ * @param fd         open file descriptor of directory.
+ * @return           true on success, false on failure.
+ */
+bool dir_reader_open(Dir_reader *dr, int fd);
+
+
+/**
+ * @brief Reads the next entry of the directory.
+ *
+ * @param dr         Dir_reader pointer to reader.
+ * @param entry      Dir_entry pointer set to the read entry.
+ * @return           1 if an entry was read, 0 at end of directory,
+ *                   -1 on error.
+ */
+int dir_reader_next(Dir_reader *dr, Dir_entry *entry);
+
+
+/**
+ * @brief Tells if the next dir_reader_next call reads from the directory
+ *        itself, rather than from the entries already in the buffer.
+ *
+ * @param dr         Dir_reader pointer to reader.
+ * @return           true if the next call makes a system call.
+ */
+bool dir_reader_refills(const Dir_reader *dr);
+
+
+/**
+ * @brief Ends reading the directory opened with dir_reader_open.
+ *
+ * @param dr         Dir_reader pointer to reader.
+ */
+void dir_reader_close(Dir_reader *dr);
+
+#endif /* DIR_READER_H */
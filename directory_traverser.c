@@ -1,399 +1,2397 @@
-/**
- * https://github.com/schmkls/do-with-all-files
- * 
- * Module used for traversing files in parallell with a given number of threads, 
- * and calling a given function with given argument with each encountered file's
- * path as input. 
- * 
- * The interface consists only of the function "do_with_all_files" 
- */
-#include "get_opts_help.h"
-#include "directory_traverser.h"
-#include "queue.h"     
-#include <pthread.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <dirent.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <semaphore.h>
-#include <stdbool.h>
-#include <string.h>
-
-
-//used to help store function and argument
-struct Func_and_arg {
-    void (*do_with_file)(char *file_path, void *arg);
-    void *arg;
-};
-
-//used to coordinate work so each file is only traversed once
-struct Traverser {
-    Queue *traversed_files;
-
-    Func_and_arg *do_with_file; 
-
-    int t_waiting;              //count of waiting threads
-    int thread_size;            //num of threads working on directory 
-    bool finished;
-
-    pthread_mutex_t modify_lock; //used to lock so only one thread modifies dir at a time
-    sem_t work_to_do;
-};
-
-//used to hold all info needed for threads to be sent to work
-struct Options {
-    Traverser **traversers;                 //will be equal to files_size
-    int files_size;                           
-    int nr_threads_to_use;
-
-    int success_status;
-};
-
-
-static bool is_navigationfile(char *path) {
-    if (strcmp(path, ".") == 0 || strcmp(path, "..") == 0) {
-        return true;
-    }
-    return false;
-}
-
-
-static char *append_path(char *destination, char *path, char *sub_path) {
-    int len = strlen(path) + strlen(sub_path) + strlen("/") + 1;
-    destination = (char*)realloc(destination, len * sizeof(char));
-    strcpy(destination, path);
-    strcat(destination, "/");
-    strcat(destination, sub_path);
-
-    return destination;
-}
-
-/**
- * Enqueues sub-directories of given directory to given queue
- * 
- * Calls the function stored in given function-and-argument-struct on 
- * each non-directory sub-file with sub-file and argument
- * stored in the struct as input.
- * 
- * @param dir_path path to directory
- * @param fq file-queue to be filled with sub-directories
- * @param func_and_arg stores users function and argument
- * @return int 0 on success, anything else indicates error
- */
-static int enqueue_sub_dirs_do_with_sub_files(char *dir_path, Queue *fq, Func_and_arg *func_and_arg) {
-    DIR *dir;
-    struct dirent *dir_pointer;
-    char *temp_file = NULL;
-    struct stat temp_file_stats;
-    int ret_status = SUCCESS;
-
-    if ((dir = opendir(dir_path)) == NULL) {
-        fprintf(stderr, "do-with-all-files: cannot read files in directory '%s'\n", dir_path); 
-        closedir(dir);
-        return FAILURE;
-    }
-
-    while ((dir_pointer = readdir(dir)) != NULL) {
-        if (!is_navigationfile(dir_pointer->d_name)) {
-            temp_file = append_path(temp_file, dir_path, dir_pointer->d_name);
-
-            if ((lstat(temp_file, &temp_file_stats)) < 0) {
-                fprintf(stderr, "do-with-all-files: can not traverse '%s'\n", temp_file);
-                closedir(dir);
-                free(temp_file);
-                ret_status = FAILURE;
-            }
-            
-            if (S_ISDIR(temp_file_stats.st_mode)) { 
-                queue_enqueue(fq, temp_file);   
-            } else {
-                func_and_arg->do_with_file(temp_file, func_and_arg->arg);
-            }
-        }
-    }
-    
-    closedir(dir);
-    free(temp_file);
-
-    return ret_status;   
-}
-
-
-/**
- * Calls the function stored in func_and_arg with file_path and argument stored
- * in func_and_arg as input. If file is a directory, returns queue with sub_directories
- * and does the function to all non-directory sub-files.  
- * 
- * @param func_and_arg function-and-argument struct storing users function and argument
- * @param file_path 
- * @return Queue* containing sub-directories of given file
- */
-static Queue *do_to_file_and_get_subfiles(Func_and_arg *func_and_arg, char *file_path) {
-    struct stat temp_file_stats;
-
-    Queue *sub_dirs;
-    if ((sub_dirs = queue_create()) == NULL) {
-        fprintf(stderr, "do-with-all-files: can not traverse '%s'\n", file_path);
-        return NULL;
-    }
-
-    if ((lstat(file_path, &temp_file_stats)) < 0) {
-        fprintf(stderr, "do-with-all-files: can not traverse '%s'\n", file_path);
-        queue_destroy(sub_dirs);
-        return NULL;
-    }
-
-    func_and_arg->do_with_file(file_path, func_and_arg->arg);
-
-    if (S_ISDIR(temp_file_stats.st_mode)) {
-        if (enqueue_sub_dirs_do_with_sub_files(file_path, sub_dirs, func_and_arg) != 0) {
-            return NULL;
-        }
-    }
-
-    return sub_dirs;
-}
-
-
-/**
- * Work-loop for one thread. The loop synchronizes traversal
- * thread-safely between threads, and lets thread quit when
- * all threads has seen that there is no more work.
- * 
- * See the image 'worker_loop' on git to understand abstraction:
- * (https://github.com/schmkls/do-with-all-files/blob/main/worker_loop.jpeg)
- * 
- * @param trav traverser-struct 
- * @return int 0 on success, anything else indicates an error
- */
-static int traverse_file(Traverser *trav) {
-    char *temp_file;
-    Queue *tmp_file_queue = queue_create();
-    
-    while (1) {        
-        pthread_mutex_lock(&trav->modify_lock);
-
-        if (!queue_is_empty(trav->traversed_files)) {
-            
-            if ((temp_file = queue_dequeue(trav->traversed_files)) == NULL) {
-                free(temp_file);
-                queue_destroy(tmp_file_queue);
-                sem_post(&trav->work_to_do);      //lure someone to work
-                return FAILURE;
-            }
-            
-        
-            pthread_mutex_unlock(&trav->modify_lock);
-
-            queue_destroy(tmp_file_queue);
-            if ((tmp_file_queue = do_to_file_and_get_subfiles(trav->do_with_file, temp_file)) == NULL) {
-                free(temp_file);
-                sem_post(&trav->work_to_do);      //lure someone to work
-                return FAILURE;
-            }
-            
-            free(temp_file);
-
-            pthread_mutex_lock(&trav->modify_lock);
-
-            //get directories from temporary directory-usage-queue
-            while (!queue_is_empty(tmp_file_queue)) {
-                char *tmp = queue_dequeue(tmp_file_queue);
-                queue_enqueue(trav->traversed_files, tmp);
-                sem_post(&trav->work_to_do);      //work to do since file was enqueued
-                trav->t_waiting--;                //one less thread expected to wait since work to do
-                free(tmp);
-            }
-        }
-
-        trav->t_waiting++;                                   //thread goes home and waits until someone calls from work
-
-        if (trav->t_waiting > trav->thread_size) {           //thread wont work if all other threads have gone home
-            trav->finished = true;
-            sem_post(&trav->work_to_do);                     //lures another thread to work to check if someone is there
-            pthread_mutex_unlock(&trav->modify_lock);
-            break;
-        }
-
-        pthread_mutex_unlock(&trav->modify_lock);
-
-        sem_wait(&trav->work_to_do);           //wait until someone at work made more work
-
-        if (trav->finished) {                  //work is no more
-            sem_post(&trav->work_to_do);       //tell the next worker to come see they too are unemployed
-            break;
-        }
-    }
-
-    queue_destroy(tmp_file_queue);
-    
-    return SUCCESS;
-}
-
-/**
- * Traverses the files stored in given options-struct
- * Sets opts's success-status to indicate error or success. 
- * 
- * @param arg options-struct
- * @return NULL
- */
-static void *traverse_directories(void *arg) {
-    Options *opts = (Options*)arg;
-
-    for (int i = 0; i < opts->files_size; i++) {
-        if (traverse_file(opts->traversers[i]) != 0) {
-            fprintf(stderr, "do-with-all-files: error traversing files\n");
-            opts->success_status = FAILURE;
-        }
-    }
-
-    return NULL;
-}
-
-
-/**
- * Sends threads to traverse files with the help of info stored in opts. 
- * Sets opts's success-status to indicate error or success. 
- * 
- * @param opts where options for traversal are stored (what files to traverse, number of threads to use, etc.)
- */
-static void send_threads_to_do_with_files(Options *opts) {
-    pthread_t threads[opts->nr_threads_to_use];
-
-    for (int i = 0; i < opts->nr_threads_to_use; i++) {
-        if ((pthread_create(&threads[i], NULL, traverse_directories, (void*)opts)) != 0) {
-            perror("pthread create");
-            opts->success_status = FAILURE;
-        }
-    }
-
-    for (int i = 0; i < opts->nr_threads_to_use; i++) {
-        if (pthread_join(threads[i], NULL) != 0) {
-            perror("pthread_join");
-            opts->success_status = FAILURE;
-        }
-    }
-}
-
-
-
-//------------------------------creation and destruction of structs--------------------------------//
-
-static Traverser *create_Traverser(char *top_dir_path, int thread_size, Func_and_arg *func_and_arg) {
-    Traverser *trav = calloc(1, sizeof(Traverser));
-    
-    trav->traversed_files = queue_create();
-    queue_enqueue(trav->traversed_files, top_dir_path);
-    trav->do_with_file = func_and_arg;    
-    trav->t_waiting = 0;
-    trav->thread_size = thread_size;
-    trav->finished = false;
-    if (pthread_mutex_init(&trav->modify_lock, NULL) != 0) {
-        return NULL;
-    }
-    sem_init(&trav->work_to_do, 0, 1);
-    
-    return trav;
-}
-
-
-static void destroy_Func_and_arg(Func_and_arg *func_and_arg) {
-    free(func_and_arg);
-    func_and_arg = NULL;
-}
-
-
-static void destroy_Traverser(Traverser *trav) {
-    queue_destroy(trav->traversed_files);
-    pthread_mutex_destroy(&trav->modify_lock);
-    sem_destroy(&trav->work_to_do);
-
-    free(trav);
-}
-
-
-static Func_and_arg *create_Func_and_arg(void (*do_with_file)(char *file_path, void *arg), void *arg) {
-    Func_and_arg *func_and_arg;
-    if ((func_and_arg = calloc(1, sizeof(Func_and_arg))) == NULL) {
-        return NULL;
-    }
-    func_and_arg->do_with_file = do_with_file;
-    func_and_arg->arg = arg;
-    return func_and_arg;
-}
-
-
-static void destroy_Options(Options *opts) {
-    if (opts != NULL) {
-        free(opts->traversers[0]->do_with_file);    //all traversers share the same do_with_file so it only has to be freed once
-        for (int i = 0; i < opts->files_size; i++) { 
-            destroy_Traverser(opts->traversers[i]);
-        }
-        free(opts->traversers);
-        free(opts);
-    }
-}
-
-//returns NULL if options could not be created
-static Options *create_Options(int files_size, char **files, void (*do_with_file)(char *file_path, void *arg), void *arg, int nr_threads_to_use) {
-    Options *user_opts;
-    Func_and_arg *func_and_arg;
-
-    if ((func_and_arg = create_Func_and_arg(do_with_file, arg)) == NULL) {
-        return NULL;
-    }
-
-    if ((user_opts = calloc(1, sizeof(Options))) == NULL) {
-        destroy_Func_and_arg(func_and_arg);
-        return NULL;
-    }
-
-    user_opts->nr_threads_to_use = nr_threads_to_use;       //one thread by default
-    user_opts->files_size = files_size;   
-    user_opts->success_status = SUCCESS; 
-    
-    if ((user_opts->traversers = calloc(files_size, sizeof(Traverser*))) == NULL) {
-        return NULL;
-    }
-
-    for (int i = 0; i < user_opts->files_size; i++){     
-        if ((user_opts->traversers[i] = create_Traverser(files[i], nr_threads_to_use, func_and_arg)) == NULL) {
-            destroy_Options(user_opts);
-            return NULL;
-        } 
-    }
-
-    return user_opts;
-}
-
-
-
-//------------------------------the function/interface--------------------------------//
-
-int do_with_all_files(void (*do_with_file)(char *file_path, void *arg), void *arg, char **files, 
-                        int files_size, int num_threads) {
-    
-    int success_status = SUCCESS;
-
-    Options *user_opts;                       //stores user options and info for threads work/coordination
-    if ((user_opts = create_Options(files_size, files, do_with_file, arg, num_threads)) == NULL) {
-        fprintf(stderr, "do-with-all-files: can not run\n");
-        return FAILURE;
-    }
-
-    send_threads_to_do_with_files(user_opts);   //the traversing and doing, sets user_opt's success-status
-    success_status = user_opts->success_status;
-    destroy_Options(user_opts);                 //freeing allocated memory
-    return success_status;
-}
-
-
-
-
-
-
-
-
-
+/**
+ * https://github.com/schmkls/do-with-all-files
+ * 
+ * Module used for traversing files in parallell with a given number of threads, 
+ * and calling a given function with given argument with each encountered file's
+ * path as input. 
+ * 
+ * The interface consists of the functions "do_with_all_files", "do_with_all_entries", 
+ * "visit_all_entries" and "reduce_all_entries", and of the long-lived contexts traversals 
+ * can be submitted to
+ */
+#define _GNU_SOURCE                 //for statx
+#include "get_opts_help.h"
+#include "directory_traverser.h"
+#include "work_deque.h"
+#include "dir_reader.h"
+#include "uring.h"
+#include "arena.h"
+#include "dir_cache.h"
+#include "filter.h"
+#include "inode_set.h"
+#include "stats.h"
+#include "trace.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <string.h>
+
+
+//used to help store function and argument
+struct Func_and_arg {
+    void (*do_with_file)(char *file_path, void *arg);
+    void (*do_with_entry)(Dwaf_entry *entry, void *arg);   //used instead of do_with_file if set
+    Dwaf_action (*visit)(Dwaf_entry *entry, void *arg);     //used instead of do_with_entry if set, steers the traversal
+    void (*do_with_batch)(Dwaf_entry *entries, int entries_size, void *arg);    //used instead of do_with_entry if set
+    Dwaf_reducer reducer;                                   //accumulate is used instead of the functions above if set
+    int batch_size;                                         //most entries given to do_with_batch at once
+    void (*root_done)(const char *root_path, int root_index, int status, void *arg);    //called when a given file is done, if set
+    void *arg;
+    unsigned int statx_mask;                                //statx fields fetched for do_with_entry
+    char *cache_path;                                       //cache of unchanged directories, rewritten after the traversal, NULL for none
+    const Dwaf_filter *filter;                              //files left out of the traversal, NULL for none
+    bool dedup_hardlinks;                                   //files with several links are only given for the first link met
+    Dwaf_stats *stats;                                      //filled in when the traversal is done, NULL if no stats are kept
+    Dwaf_order order;                                       //order directories are read in
+    long frontier_limit;                                    //bytes of queued directories DWAF_HYBRID turns depth-first at
+    char *trace_path;                                       //trace written when the traversal is done, NULL for none
+};
+
+//used to coordinate work so each file is only traversed once, the directories of all given files share it
+struct Traverser {
+    Work_deque **deques;        //one deque of directories per thread, stolen from when own is empty
+
+    Func_and_arg *do_with_file; 
+
+    int thread_size;            //num of threads working on directory, the most that can be started when adaptive
+    atomic_int started;         //threads that were started, whose deques are stolen from
+    atomic_int active;          //threads allowed to take work, the others sleep while theirs is stolen
+    atomic_long pending;        //directories enqueued but not yet fully traversed (of any given file), 0 means finished
+    atomic_bool failed;
+    atomic_bool aborted;        //the user's function asked to stop, queued directories are then dropped unread
+
+    atomic_int held_fds;        //directories kept open for their enqueued sub-directories (or chunks)
+    atomic_int queued_chunks;   //chunks of huge directories queued but not yet taken
+    atomic_long frontier_bytes; //bytes of work items queued or being read, only counted for DWAF_HYBRID
+    int max_held_fds;           //above this, sub-directories are opened by full path instead
+
+    Dir_cache *cache;           //directories that did not change since it was written are not read, NULL for none
+    Cache_writer *cache_out;    //records every directory, with one part per thread, NULL for none
+    Inode_set *inodes;          //files with several links met so far, NULL if all links are given
+
+    bool adaptive;              //the number of active threads is tuned while traversing
+    int cpus;                   //threads that are active when adaptive traversals start
+    atomic_long next_tune_ns;   //when the number of active threads is next tuned
+    atomic_bool tuning;         //a thread is tuning, the others carry on
+    long tuned_ns;              //time of the last tuning, and the threads' summed times then:
+    long tuned_busy_ns, tuned_cpu_ns, tuned_idle_ns;
+    long started_ns;            //when the current job started, only measured when it keeps stats or is traced
+    Trace *trace;               //what each thread of the current job did when, NULL unless it is traced
+};
+
+typedef struct Root Root;
+
+//an open directory shared by its enqueued sub-directories, which are opened relative to it
+typedef struct Dir_ref {
+    int fd;                                 //-1 if sub-directories have to be opened by full path
+    int depth;                              //-1 for the reference a given file is enqueued with
+    Root *root;                             //given file the directory is under
+    atomic_int refs;                        //the reading thread's reference plus one per enqueued sub-directory
+} Dir_ref;
+
+//one of the given files, whose directories are traversed together with those of the other given files
+struct Root {
+    char *path;
+    int index;                              //index in the given files
+    Dir_ref above;                          //never open, parent reference of the given file's work item
+    atomic_long pending;                    //directories of this file enqueued but not yet fully traversed
+    atomic_bool failed;
+};
+
+//used to hold all info needed for threads to be sent to work on one traversal
+struct Options {
+    Func_and_arg *do_with_file;
+    char **files;
+    Root *roots;                            //will be equal to files_size
+    int files_size;                           
+
+    atomic_int success_status;
+};
+
+//a traversal submitted to a context
+struct Dwaf_job {
+    Options *opts;
+    Dwaf_job *next;                         //next job in the context's queue
+    bool done;
+    int status;                             //success-status of the traversal once done
+};
+
+typedef struct Worker Worker;
+
+//threads and buffers kept between traversals, the traversals are done one at a time in the order they were submitted
+struct Dwaf_context {
+    Traverser *trav;                        //coordinates the current job, its deques are reused by every job
+    Worker *workers;
+    pthread_t *threads;
+    int thread_size;
+    int started_size;                       //threads that were started
+    Arena *arena;                           //work items of the given files of the current job
+
+    pthread_mutex_t lock;                   //guards the fields below
+    pthread_cond_t work_ready;              //signaled when a job is started or the context is destroyed
+    pthread_cond_t job_done;
+    Dwaf_job *current;                      //job the threads work on, NULL if none
+    Dwaf_job *queue_head;                   //submitted jobs waiting for the current one to be done
+    Dwaf_job *queue_tail;
+    unsigned long generation;               //counts started jobs, so threads tell a new job from the one they did
+    int working;                            //threads not yet done with the current job
+    bool quit;
+};
+
+//path buffer reused for every entry, only grown when a longer path than before is met
+typedef struct Path_buf {
+    char *str;
+    size_t size;
+} Path_buf;
+
+#define URING_ENTRIES 64                    //operations one thread's ring can have in flight
+#define STAT_BATCH_SIZE 64                  //entries stat:ed with one ring submission
+#define OPEN_BATCH_SIZE 8                   //directories opened with one ring submission
+#define SUBDIR_BATCH_SIZE 256               //sub-directories pushed to the thread's deque at once
+#define STEAL_BATCH_SIZE 32                 //most directories stolen at once
+#define DIR_CHUNK_THRESHOLD 2048            //entries of a directory read before the rest are handed out in chunks
+#define DIR_CHUNK_SIZE 1024                 //most entries in one chunk
+#define DIR_CHUNK_NAMES_SIZE (32 * 1024)    //bytes of names one chunk holds
+#define MAX_QUEUED_CHUNKS_PER_THREAD 4      //above this many queued chunks per active thread, the reader handles its own
+#define CHUNK_DEPTH -2                      //depth of the reference a chunk is enqueued with, tells it from a directory
+#define ITEM_CLASS_SIZE 32                  //work items are made in multiples of this, so items done with can be reused
+#define ITEM_CLASSES 128                    //size classes of reused work items, longer paths are not reused
+
+//entries of one directory collected for one call of the user's batch function
+typedef struct Entry_batch {
+    Dwaf_entry *entries;
+    size_t *path_offsets;                   //where each entry's path is in paths
+    int size;
+    Path_buf paths;                         //the entries' paths are copied, since the thread's path buffer is reused
+    size_t paths_used;
+    int capacity;                           //most entries the batch can hold
+} Entry_batch;
+
+//entries of one directory waiting to be stat:ed together through the thread's ring
+typedef struct Stat_batch {
+    int size;
+    size_t names_used;
+    char names[STAT_BATCH_SIZE * (NAME_MAX + 1)];
+    int name_offsets[STAT_BATCH_SIZE];
+    unsigned char d_types[STAT_BATCH_SIZE];
+    struct statx stx[STAT_BATCH_SIZE];
+    int results[STAT_BATCH_SIZE];           //0 or negative errno of each statx
+} Stat_batch;
+
+//entries of a huge directory read by one thread, to be stat:ed and given to the user's function by any thread
+typedef struct Dir_chunk {
+    Dir_ref tag;                            //what the chunk's work item points to, only depth (CHUNK_DEPTH) and root are set
+    Dir_ref *dir;                           //the directory, held open until all its chunks are done
+    int size;
+    size_t names_used;
+    int name_offsets[DIR_CHUNK_SIZE];
+    unsigned char d_types[DIR_CHUNK_SIZE];
+    char names[DIR_CHUNK_NAMES_SIZE];
+} Dir_chunk;
+
+//what one thread needs to know to go to work, and the buffers it reuses for every directory and traversal
+struct Worker {
+    Dwaf_context *ctx;
+    int id;                                 //index of the thread's own deque in the traverser
+    unsigned long generation;               //of the last job the thread worked on
+    Path_buf pb;
+    Dir_reader *dr;
+    Uring *ring;                            //NULL when io_uring is not compiled in or not available
+    Stat_batch *batch;                      //only allocated together with ring
+    Entry_batch *out;                       //only allocated once a job's function takes batches
+    void *state;                            //the thread's own state of the user's reducer, merged when the job is done
+    Arena *arena;                           //work items and directory references made by the thread, reset after each job
+    Work_item *subdirs[SUBDIR_BATCH_SIZE];  //sub-directories found but not yet pushed to the thread's deque
+    Work_item *free_items[ITEM_CLASSES];    //work items the thread is done with by size class, linked by data, reused first
+    int subdirs_size;
+    atomic_long busy_ns;                    //time spent on directories (only measured when adaptive)
+    atomic_long cpu_ns;                     //of busy_ns, time spent running rather than waiting for I/O
+    atomic_long idle_ns;                    //time spent looking for work while active
+    Dwaf_thread_stats *stats;               //what the thread did in the current job, NULL unless the job keeps stats
+    Trace_buf *trace;                       //the thread's events in the current job, NULL unless the job is traced
+};
+
+//the directory a thread is reading
+typedef struct Dir_scan {
+    char *dir_path;
+    int fd;
+    int depth;
+    size_t prefix_len;                      //length of "dir_path/" in the thread's path buffer
+    Root *root;
+    Dir_ref *self;                          //referenced on first sub-directory
+    long entries_size;                      //entries read or replayed
+    const struct statx *dir_stx;            //the directory's own statx, NULL if it was not stat:ed
+    bool recording;                         //entries are recorded in the thread's part of the new cache
+    bool chunkable;                         //the rest of the entries may yet be handed out in chunks
+    Dir_chunk *chunk;                       //entries being collected for other threads, NULL when not chunking
+    int status;
+} Dir_scan;
+
+#define CACHE_LINE_SIZE 64
+
+#define SPINS_BEFORE_SLEEP 64               //idle rounds spent yielding before starting to sleep
+#define MAX_IDLE_SLEEP_NS 1000000           //longest sleep of an idle thread between steal attempts
+
+#define ADAPTIVE_THREADS_PER_CPU 8          //most threads an adaptive context starts per CPU, within the limits below
+#define ADAPTIVE_MIN_THREADS 16
+#define ADAPTIVE_MAX_THREADS 256
+#define TUNE_INTERVAL_NS 20000000L          //time between tunings of the number of active threads
+
+
+static bool is_navigationfile(const char *path) {
+    if (strcmp(path, ".") == 0 || strcmp(path, "..") == 0) {
+        return true;
+    }
+    return false;
+}
+
+
+static bool path_buf_reserve(Path_buf *pb, size_t len) {
+    if (len > pb->size) {
+        char *grown;
+        size_t new_size = pb->size == 0 ? 256 : pb->size;
+        while (new_size < len) {
+            new_size *= 2;
+        }
+        if ((grown = realloc(pb->str, new_size)) == NULL) {
+            return false;
+        }
+        pb->str = grown;
+        pb->size = new_size;
+    }
+    return true;
+}
+
+//writes "dir_path/" to the start of the buffer, returns its length (0 on failure)
+static size_t path_buf_set_dir(Path_buf *pb, const char *dir_path) {
+    size_t len = strlen(dir_path);
+    if (!path_buf_reserve(pb, len + 2)) {
+        return 0;
+    }
+    memcpy(pb->str, dir_path, len);
+    pb->str[len] = '/';
+    pb->str[len + 1] = '\0';
+    return len + 1;
+}
+
+//writes name after the directory prefix of the buffer
+static bool path_buf_set_name(Path_buf *pb, size_t prefix_len, const char *name) {
+    size_t len = strlen(name);
+    if (!path_buf_reserve(pb, prefix_len + len + 1)) {
+        return false;
+    }
+    memcpy(pb->str + prefix_len, name, len + 1);
+    return true;
+}
+
+
+//current time of clock in nanoseconds
+static long clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+//tells if the thread times what it does, for its stats or the trace
+static bool is_timed(Worker *worker) {
+    return worker->stats != NULL || worker->trace != NULL;
+}
+
+
+//start time of an operation the thread times, 0 if it times nothing
+static long op_start(Worker *worker) {
+    return is_timed(worker) ? clock_ns(CLOCK_MONOTONIC) : 0;
+}
+
+
+//records an operation of the thread that started at start, in its stats and the trace
+static void op_end(Worker *worker, Dwaf_op op, long start) {
+    long end;
+
+    if (!is_timed(worker)) {
+        return;
+    }
+    end = clock_ns(CLOCK_MONOTONIC);
+    if (worker->stats != NULL) {
+        stats_record(worker->stats, op, end - start);
+    }
+    if (worker->trace != NULL) {
+        trace_add(worker->trace, (Trace_kind)op, start, end, NULL, 0);
+    }
+}
+
+
+//start time of an event the thread traces, 0 if the job is not traced
+static long trace_start(Worker *worker) {
+    return worker->trace != NULL ? clock_ns(CLOCK_MONOTONIC) : 0;
+}
+
+
+//records an event of the thread that started at start in the trace, if the job is traced
+static void trace_end(Worker *worker, Trace_kind kind, long start, const char *path, long arg) {
+    if (worker->trace != NULL) {
+        trace_add(worker->trace, kind, start, clock_ns(CLOCK_MONOTONIC), path, arg);
+    }
+}
+
+
+//opens directory relative to its parent, or by full path if it has no open parent
+static int open_dir(Worker *worker, Dir_ref *parent, const char *dir_path) {
+    long start = op_start(worker);
+    int fd;
+
+    if (parent->fd < 0) {
+        fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    } else {
+        fd = openat(parent->fd, strrchr(dir_path, '/') + 1, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    op_end(worker, DWAF_OP_OPEN, start);
+    return fd;
+}
+
+
+//references directory for its sub-directories, fd is only kept if not too many directories are held open already
+static Dir_ref *hold_dir(Traverser *trav, Worker *worker, Root *root, int fd, int depth) {
+    Dir_ref *ref;
+
+    if ((ref = arena_alloc(worker->arena, sizeof(Dir_ref))) == NULL) {
+        return NULL;
+    }
+    ref->fd = fd;
+    if (atomic_fetch_add(&trav->held_fds, 1) >= trav->max_held_fds) {
+        atomic_fetch_sub(&trav->held_fds, 1);
+        ref->fd = -1;
+    }
+    ref->depth = depth;
+    ref->root = root;
+    atomic_init(&ref->refs, 1);
+    return ref;
+}
+
+
+//calls the user's function for given file once all its directories are done
+static void report_root(Traverser *trav, Root *root) {
+    int status = atomic_load(&root->failed) ? FAILURE : SUCCESS;
+
+    if (status != SUCCESS) {
+        fprintf(stderr, "do-with-all-files: error traversing '%s'\n", root->path);
+        atomic_store(&trav->failed, true);
+    }
+    if (trav->do_with_file->root_done != NULL) {
+        trav->do_with_file->root_done(root->path, root->index, status, trav->do_with_file->arg);
+    }
+}
+
+
+//done with one directory of given file, after its sub-directories were counted
+static void finish_work(Traverser *trav, Root *root, bool failed) {
+    if (failed) {
+        atomic_store(&root->failed, true);
+    }
+    if (atomic_fetch_sub(&root->pending, 1) == 1) {
+        report_root(trav, root);            //before pending of the traverser can reach 0, so before threads quit
+    }
+    atomic_fetch_sub(&trav->pending, 1);
+}
+
+
+//drops a reference to directory, its memory stays in the arena until the traversal is done
+static void release_dir(Traverser *trav, Dir_ref *ref) {
+    if (ref != NULL && atomic_fetch_sub(&ref->refs, 1) == 1) {
+        if (ref->fd >= 0) {
+            close(ref->fd);
+            atomic_fetch_sub(&trav->held_fds, 1);
+        }
+    }
+}
+
+
+//calls the user's function with entry, in the form the user asked for (state is the thread's reducer state)
+static Dwaf_action deliver(Worker *worker, Func_and_arg *func_and_arg, void *state, Dwaf_entry *entry) {
+    Dwaf_action action = DWAF_CONTINUE;
+    long start = op_start(worker);
+
+    if (func_and_arg->visit != NULL) {
+        action = func_and_arg->visit(entry, func_and_arg->arg);
+    } else if (func_and_arg->reducer.accumulate != NULL) {
+        func_and_arg->reducer.accumulate(state, entry, func_and_arg->arg);
+    } else if (func_and_arg->do_with_batch != NULL) {
+        func_and_arg->do_with_batch(entry, 1, func_and_arg->arg);
+    } else if (func_and_arg->do_with_entry != NULL) {
+        func_and_arg->do_with_entry(entry, func_and_arg->arg);
+    } else {
+        func_and_arg->do_with_file((char*)entry->path, func_and_arg->arg);
+    }
+    op_end(worker, DWAF_OP_CALLBACK, start);
+    return action;
+}
+
+
+static bool is_aborted(Traverser *trav) {
+    return atomic_load_explicit(&trav->aborted, memory_order_relaxed);
+}
+
+
+//calls the user's batch function with the entries collected by the thread, if any
+static void deliver_batch(Worker *worker, Func_and_arg *func_and_arg, Entry_batch *out) {
+    long start;
+
+    if (out == NULL || out->size == 0) {
+        return;
+    }
+    for (int i = 0; i < out->size; i++) {
+        out->entries[i].path = out->paths.str + out->path_offsets[i];
+    }
+    start = op_start(worker);
+    func_and_arg->do_with_batch(out->entries, out->size, func_and_arg->arg);
+    op_end(worker, DWAF_OP_CALLBACK, start);
+    out->size = 0;
+    out->paths_used = 0;
+}
+
+
+//adds entry to the thread's batch, the batch is delivered when full
+static void collect_entry(Worker *worker, Func_and_arg *func_and_arg, Entry_batch *out, Dwaf_entry *entry) {
+    size_t len = strlen(entry->path) + 1;
+
+    if (!path_buf_reserve(&out->paths, out->paths_used + len)) {
+        deliver_batch(worker, func_and_arg, out);       //no memory to collect it, so it is delivered alone
+        deliver(worker, func_and_arg, NULL, entry);
+        return;
+    }
+    if (worker->stats != NULL) {
+        worker->stats->path_bytes += len;
+    }
+    memcpy(out->paths.str + out->paths_used, entry->path, len);
+    out->entries[out->size] = *entry;
+    out->path_offsets[out->size] = out->paths_used;
+    out->paths_used += len;
+    if (++out->size == func_and_arg->batch_size) {
+        deliver_batch(worker, func_and_arg, out);
+    }
+}
+
+
+//fetches the mask's statx fields of name in dir_fd into entry, and fills in d_type from them if unknown
+static bool fetch_statx(Worker *worker, int dir_fd, const char *name, int flags, unsigned int mask, Dwaf_entry *entry) {
+    long start = op_start(worker);
+    int status = statx(dir_fd, name, flags | AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &entry->stx);
+
+    op_end(worker, DWAF_OP_STATX, start);
+    if (status < 0) {
+        return false;
+    }
+    entry->stx_mask = entry->stx.stx_mask;
+    if (entry->d_type == DT_UNKNOWN && (entry->stx_mask & STATX_TYPE)) {
+        entry->d_type = IFTODT(entry->stx.stx_mode);
+    }
+    return true;
+}
+
+
+/**
+ * Fills in type and wanted metadata of directory entry. The type readdir 
+ * returns is trusted, the entry is only stat:ed when the file system does 
+ * not fill in the type (DT_UNKNOWN) or when the user asked for metadata. 
+ * 
+ * @param worker calling thread
+ * @param dir_fd open file descriptor of the directory holding the entry
+ * @param dir_entry directory entry as read
+ * @param mask statx fields the user wants, 0 for none
+ * @param entry entry to fill in (symbolic links are not followed)
+ * @return true on success, false if entry could not be stat:ed
+ */
+static bool fill_entry(Worker *worker, int dir_fd, Dir_entry *dir_entry, unsigned int mask, Dwaf_entry *entry) {
+    entry->d_type = dir_entry->type;
+    entry->stx_mask = 0;
+
+    if (entry->d_type == DT_UNKNOWN) {
+        mask |= STATX_TYPE;
+    }
+    if (mask == 0) {
+        return true;
+    }
+    return fetch_statx(worker, dir_fd, dir_entry->name, 0, mask, entry);
+}
+
+
+//makes a work item of path in the thread's arena
+static Work_item *make_work_item(Arena *arena, const char *path, size_t len, Dir_ref *parent) {
+    Work_item *item;
+
+    if ((item = arena_alloc(arena, sizeof(Work_item) + len + 1)) == NULL) {
+        return NULL;
+    }
+    memcpy(item->path, path, len + 1);
+    item->data = parent;
+    return item;
+}
+
+
+//tells if work item is a chunk of a huge directory's entries rather than a directory
+static bool is_chunk(const Work_item *item) {
+    return ((const Dir_ref*)item->data)->depth == CHUNK_DEPTH;
+}
+
+
+//gives back a chunk that was taken, or could not be queued, and its reference to its directory
+static void release_chunk(Traverser *trav, Dir_chunk *chunk) {
+    atomic_fetch_sub(&trav->queued_chunks, 1);
+    release_dir(trav, chunk->dir);
+    free(chunk);
+}
+
+
+//size class of the work item of a path of len bytes
+static size_t item_class(size_t len) {
+    return (sizeof(Work_item) + len + 1 + ITEM_CLASS_SIZE - 1) / ITEM_CLASS_SIZE;
+}
+
+
+//makes a work item of path, reusing one of its size class the thread is done with if it has one
+static Work_item *new_work_item(Worker *worker, const char *path, size_t len, Dir_ref *parent) {
+    size_t size_class = item_class(len);
+    Work_item *item;
+
+    if (size_class >= ITEM_CLASSES) {
+        return make_work_item(worker->arena, path, len, parent);
+    }
+    if ((item = worker->free_items[size_class]) != NULL) {
+        worker->free_items[size_class] = item->data;
+    } else if ((item = arena_alloc(worker->arena, size_class * ITEM_CLASS_SIZE)) == NULL) {
+        return NULL;
+    }
+    memcpy(item->path, path, len + 1);
+    item->data = parent;
+    return item;
+}
+
+
+/**
+ * Gives back the work item of a directory or chunk the calling thread is
+ * done with, for the thread to reuse for the next one it queues, so the 
+ * memory of the work items follows the number of queued directories 
+ * rather than the number of directories traversed. Must be called before
+ * a chunk is released. The items of the given files are made by the 
+ * context, and the paths of traced directories are kept by the trace, so 
+ * those are not reused.
+ * 
+ * @param trav traverser
+ * @param worker calling thread
+ * @param item work item done with
+ */
+static void recycle_work_item(Traverser *trav, Worker *worker, Work_item *item) {
+    Dir_ref *parent = item->data;
+    size_t size_class;
+
+    if (parent == &parent->root->above) {
+        return;
+    }
+    size_class = item_class(strlen(item->path));
+    if (trav->do_with_file->order == DWAF_HYBRID) {
+        atomic_fetch_sub_explicit(&trav->frontier_bytes, size_class * ITEM_CLASS_SIZE, memory_order_relaxed);
+    }
+    if (size_class >= ITEM_CLASSES || worker->trace != NULL) {
+        return;
+    }
+    item->data = worker->free_items[size_class];
+    worker->free_items[size_class] = item;
+}
+
+
+//counts work items about to be queued in the bytes DWAF_HYBRID picks its order by
+static void add_frontier(Traverser *trav, Work_item **items, int n) {
+    long bytes = 0;
+
+    if (trav->do_with_file->order != DWAF_HYBRID) {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        bytes += item_class(strlen(items[i]->path)) * ITEM_CLASS_SIZE;
+    }
+    atomic_fetch_add_explicit(&trav->frontier_bytes, bytes, memory_order_relaxed);
+}
+
+
+//gives up work that could not be queued, so the traversal can still finish
+static void drop_work(Traverser *trav, Worker *worker, Work_item **items, int n) {
+    for (int i = 0; i < n; i++) {
+        Dir_ref *parent = items[i]->data;
+        Root *root = parent->root;
+        bool chunk = is_chunk(items[i]);
+        fprintf(stderr, "do-with-all-files: can not traverse '%s'\n", items[i]->path);
+        recycle_work_item(trav, worker, items[i]);
+        if (chunk) {
+            release_chunk(trav, (Dir_chunk*)parent);
+        } else {
+            release_dir(trav, parent);
+        }
+        finish_work(trav, root, true);
+    }
+}
+
+
+//moves the sub-directories collected by the thread, all under given file, to its deque in one go
+static void push_subdirs(Traverser *trav, Worker *worker, Root *root) {
+    int n = worker->subdirs_size;
+    long start;
+
+    if (n == 0) {
+        return;
+    }
+    start = trace_start(worker);
+    worker->subdirs_size = 0;
+    atomic_fetch_add(&root->pending, n);    //counted before parent is done, so pending never hits 0 early
+    atomic_fetch_add(&trav->pending, n);
+    add_frontier(trav, worker->subdirs, n);
+    if (!work_deque_push_batch(trav->deques[worker->id], worker->subdirs, n)) {
+        drop_work(trav, worker, worker->subdirs, n);
+    }
+    trace_end(worker, TRACE_PUSH, start, NULL, n);
+}
+
+
+//tells if entry is to be given, which a file with several links only is for the first link met
+static bool is_first_link(Traverser *trav, Dwaf_entry *entry) {
+    if (trav->inodes == NULL || entry->d_type == DT_DIR 
+            || (entry->stx_mask & (STATX_NLINK | STATX_INO)) != (STATX_NLINK | STATX_INO)) {
+        return true;
+    }
+    return inode_set_first_link(trav->inodes, makedev(entry->stx.stx_dev_major, entry->stx.stx_dev_minor), 
+                                entry->stx.stx_ino, entry->stx.stx_nlink);
+}
+
+
+//calls the user's function with entry, whose path is in the thread's path buffer, and collects it if it is a directory
+static void handle_entry(Traverser *trav, Worker *worker, Dir_scan *scan, Dwaf_entry *entry) {
+    const Dwaf_filter *filter = trav->do_with_file->filter;
+    Dwaf_action action = DWAF_CONTINUE;
+    Work_item *item;
+
+    if (is_aborted(trav)) {
+        return;
+    }
+    if (filter != NULL && filter_skips_entry(filter, worker->pb.str + scan->prefix_len, entry)) {
+        return;
+    }
+    entry->path = worker->pb.str;
+    if (scan->recording) {
+        cache_writer_add_entry(trav->cache_out, worker->id, entry->path + scan->prefix_len, entry->d_type, 
+                                entry->stx_mask, &entry->stx);
+    }
+    if (!is_first_link(trav, entry)) {
+        return;
+    }
+    if (worker->out != NULL) {
+        collect_entry(worker, trav->do_with_file, worker->out, entry);
+    } else {
+        action = deliver(worker, trav->do_with_file, worker->state, entry);
+    }
+    if (action == DWAF_ABORT) {
+        atomic_store(&trav->aborted, true);
+        return;
+    }
+
+    if (entry->d_type == DT_DIR && action != DWAF_SKIP_SUBTREE && (filter == NULL || !filter_prunes(filter, entry->depth))) { 
+        if ((scan->self == NULL && (scan->self = hold_dir(trav, worker, scan->root, scan->fd, scan->depth)) == NULL)
+                || (item = new_work_item(worker, entry->path, scan->prefix_len + strlen(entry->path + scan->prefix_len), scan->self)) == NULL) {
+            fprintf(stderr, "do-with-all-files: can not traverse '%s'\n", entry->path);
+            scan->status = FAILURE;
+            return;
+        }
+        if (worker->stats != NULL) {
+            worker->stats->path_bytes += strlen(item->path) + 1;
+        }
+        atomic_fetch_add(&scan->self->refs, 1);
+        worker->subdirs[worker->subdirs_size++] = item;
+        if (worker->subdirs_size == SUBDIR_BATCH_SIZE) {
+            push_subdirs(trav, worker, scan->root);
+        }
+    }
+}
+
+
+//submits the operations queued on the thread's ring and waits for wait_nr of them to complete
+static bool submit_and_wait(Worker *worker, unsigned int wait_nr) {
+    long start = op_start(worker);
+    bool submitted = uring_submit_and_wait(worker->ring, wait_nr);
+
+    op_end(worker, DWAF_OP_URING, start);
+    return submitted;
+}
+
+
+/**
+ * Stops using the thread's ring after it failed. Every call still in 
+ * flight is waited for (and the directories opened by them closed), so 
+ * the kernel no longer writes into the thread's batch or returns late 
+ * completions, then the ring is destroyed and the thread stays with plain
+ * system calls. If the calls can not be waited for, the batch is left
+ * allocated, since the kernel may still write into it.
+ * 
+ * @param worker calling thread, whose batch must not be used after
+ * @param opens true if the calls in flight are opens, false if they are statx calls
+ */
+static void give_up_ring(Worker *worker, bool opens) {
+    if (uring_drain(worker->ring, opens)) {
+        free(worker->batch);
+    }
+    uring_destroy(worker->ring);
+    worker->ring = NULL;
+    worker->batch = NULL;
+}
+
+
+/**
+ * Stats the entries collected in the thread's batch with one submission 
+ * to the thread's ring, then handles them in the order they were read.
+ * Falls back to plain statx calls if the ring fails.
+ * 
+ * @param trav traverser
+ * @param worker calling thread
+ * @param scan directory the entries are in
+ */
+static void flush_stat_batch(Traverser *trav, Worker *worker, Dir_scan *scan) {
+    Stat_batch *batch = worker->batch;
+    unsigned int mask = trav->do_with_file->statx_mask;
+    Dwaf_entry entry = {.parent_fd = scan->fd, .name_offset = (int)scan->prefix_len, .depth = scan->depth + 1, 
+                        .root_index = scan->root->index};
+    bool submitted = true;
+    int completed = 0;
+
+    for (int i = 0; i < batch->size; i++) {
+        unsigned int entry_mask = batch->d_types[i] == DT_UNKNOWN ? mask | STATX_TYPE : mask;
+        batch->results[i] = -EIO;
+        submitted = submitted && uring_queue_statx(worker->ring, scan->fd, batch->names + batch->name_offsets[i], 
+                                    AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, entry_mask, &batch->stx[i], (uint64_t)i);
+    }
+    if (worker->stats != NULL) {
+        worker->stats->syscalls += batch->size;
+    }
+    submitted = submitted && submit_and_wait(worker, (unsigned int)batch->size);
+    while (submitted && completed < batch->size) {
+        uint64_t index;
+        int res;
+        if (uring_next_completion(worker->ring, &index, &res)) {
+            batch->results[index] = res;
+            completed++;
+        } else if (!submit_and_wait(worker, (unsigned int)(batch->size - completed))) {
+            submitted = false;
+        }
+    }
+
+    for (int i = 0; i < batch->size; i++) {
+        char *name = batch->names + batch->name_offsets[i];
+
+        entry.d_type = batch->d_types[i];
+        entry.stx_mask = 0;
+        if (!path_buf_set_name(&worker->pb, scan->prefix_len, name)) {
+            batch->results[i] = -ENOMEM;
+        } else if (!submitted) {                                //ring failed, do it the synchronous way
+            batch->results[i] = fetch_statx(worker, scan->fd, name, 0, entry.d_type == DT_UNKNOWN ? mask | STATX_TYPE : mask, &entry) ? 0 : -errno;
+        } else if (batch->results[i] == 0) {
+            entry.stx = batch->stx[i];
+            entry.stx_mask = entry.stx.stx_mask;
+            if (entry.d_type == DT_UNKNOWN && (entry.stx_mask & STATX_TYPE)) {
+                entry.d_type = IFTODT(entry.stx.stx_mode);
+            }
+        }
+        if (batch->results[i] < 0) {
+            fprintf(stderr, "do-with-all-files: can not traverse '%s/%s'\n", scan->dir_path, name);
+            scan->status = FAILURE;
+            continue;
+        }
+        handle_entry(trav, worker, scan, &entry);
+    }
+    batch->size = 0;
+    batch->names_used = 0;
+    if (!submitted) {
+        give_up_ring(worker, false);
+    }
+}
+
+
+//reads the next entry of the directory the thread's reader is opened on, timing the reads from the directory itself
+static int next_dir_entry(Worker *worker, Dir_entry *dir_entry) {
+    long start;
+    int read_status;
+
+    if (!is_timed(worker) || !dir_reader_refills(worker->dr)) {
+        return dir_reader_next(worker->dr, dir_entry);
+    }
+    start = op_start(worker);
+    read_status = dir_reader_next(worker->dr, dir_entry);
+    op_end(worker, DWAF_OP_GETDENTS, start);
+    return read_status;
+}
+
+
+//stats an entry read from the directory being scanned if needed, in the thread's batch if it has a ring, and handles it
+static void scan_entry(Traverser *trav, Worker *worker, Dir_scan *scan, Dwaf_entry *entry, Dir_entry *dir_entry) {
+    unsigned int mask = trav->do_with_file->statx_mask;
+    Stat_batch *batch = worker->batch;
+
+    if (batch != NULL && (mask != 0 || dir_entry->type == DT_UNKNOWN)) {
+        size_t name_len = strlen(dir_entry->name) + 1;
+        memcpy(batch->names + batch->names_used, dir_entry->name, name_len);
+        batch->name_offsets[batch->size] = (int)batch->names_used;
+        batch->d_types[batch->size] = dir_entry->type;
+        batch->names_used += name_len;
+        if (++batch->size == STAT_BATCH_SIZE) {
+            flush_stat_batch(trav, worker, scan);
+        }
+        return;
+    }
+    if (!path_buf_set_name(&worker->pb, scan->prefix_len, dir_entry->name)
+            || !fill_entry(worker, scan->fd, dir_entry, mask, entry)) {
+        fprintf(stderr, "do-with-all-files: can not traverse '%s/%s'\n", scan->dir_path, dir_entry->name);
+        scan->status = FAILURE;
+        return;
+    }
+    handle_entry(trav, worker, scan, entry);
+}
+
+
+/**
+ * Handles a chunk of the entries of a huge directory the way the thread
+ * reading the directory would have: stats them if needed and gives them to
+ * the user's function. Sub-directories among them are referenced by the
+ * directory's held reference, so they are opened relative to it.
+ * 
+ * @param trav traverser
+ * @param worker calling thread, the reading one or any other
+ * @param chunk chunk to handle
+ * @param dir_path path of the directory
+ * @return int 0 on success, anything else indicates error
+ */
+static int handle_chunk(Traverser *trav, Worker *worker, Dir_chunk *chunk, char *dir_path) {
+    Dir_ref *dir = chunk->dir;
+    long start = trace_start(worker);
+    Dir_scan scan = {.dir_path = dir_path, .fd = dir->fd, .depth = dir->depth, .root = dir->root, .self = dir, 
+                        .entries_size = chunk->size, .dir_stx = NULL, .recording = false, .chunkable = false, 
+                        .chunk = NULL, .status = SUCCESS};
+    Dwaf_entry entry;
+
+    if ((scan.prefix_len = path_buf_set_dir(&worker->pb, dir_path)) == 0) {
+        fprintf(stderr, "do-with-all-files: cannot read files in directory '%s'\n", dir_path); 
+        return FAILURE;
+    }
+    entry.parent_fd = scan.fd;
+    entry.name_offset = (int)scan.prefix_len;
+    entry.depth = scan.depth + 1;
+    entry.root_index = scan.root->index;
+    for (int i = 0; i < chunk->size && !is_aborted(trav); i++) {
+        Dir_entry dir_entry = {.name = chunk->names + chunk->name_offsets[i], .type = chunk->d_types[i]};
+        scan_entry(trav, worker, &scan, &entry, &dir_entry);
+    }
+    if (worker->batch != NULL && worker->batch->size > 0) {
+        flush_stat_batch(trav, worker, &scan);
+    }
+    deliver_batch(worker, trav->do_with_file, worker->out);     //while the chunk still holds the directory open
+    push_subdirs(trav, worker, scan.root);
+    trace_end(worker, TRACE_CHUNK, start, dir_path, chunk->size);
+    return scan.status;
+}
+
+
+//makes an empty chunk for the rest of the entries of the directory being scanned, NULL on failure
+static Dir_chunk *create_chunk(Dir_scan *scan) {
+    Dir_chunk *chunk;
+
+    if ((chunk = malloc(sizeof(Dir_chunk))) == NULL) {
+        return NULL;
+    }
+    chunk->tag.fd = -1;
+    chunk->tag.depth = CHUNK_DEPTH;
+    chunk->tag.root = scan->root;
+    atomic_init(&chunk->tag.refs, 0);
+    chunk->dir = scan->self;
+    chunk->size = 0;
+    chunk->names_used = 0;
+    return chunk;
+}
+
+
+/**
+ * Starts handing the rest of the entries of the directory being scanned
+ * out in chunks, once it has turned out to be huge. Only done when other
+ * threads can take the chunks, and the directory can be held open for
+ * them. Never done while the directory is recorded in the cache, since
+ * each thread records its directories in order.
+ * 
+ * @param trav traverser
+ * @param worker calling thread, which reads the directory
+ * @param scan directory being scanned
+ * @return true if the rest of the entries are collected in chunks
+ */
+static bool start_chunks(Traverser *trav, Worker *worker, Dir_scan *scan) {
+    scan->chunkable = false;
+    if (scan->recording || atomic_load_explicit(&trav->active, memory_order_relaxed) < 2) {
+        return false;
+    }
+    if ((scan->self == NULL && (scan->self = hold_dir(trav, worker, scan->root, scan->fd, scan->depth)) == NULL)
+            || scan->self->fd < 0) {
+        return false;
+    }
+    if (worker->batch != NULL && worker->batch->size > 0) {     //the entries read so far are handled by the reader
+        flush_stat_batch(trav, worker, scan);
+    }
+    return (scan->chunk = create_chunk(scan)) != NULL;
+}
+
+
+/**
+ * Queues the full chunk of the directory being scanned to the reading 
+ * thread's deque, for any thread to take, and starts a new one. When 
+ * enough chunks are queued already, the reader handles the chunk itself 
+ * instead, so a directory read faster than its entries are handled does 
+ * not pile up in memory.
+ * 
+ * @param trav traverser that counts the queued chunk as pending work
+ * @param worker calling thread, which reads the directory
+ * @param scan directory being scanned
+ */
+static void publish_chunk(Traverser *trav, Worker *worker, Dir_scan *scan) {
+    Dir_chunk *chunk = scan->chunk;
+    Work_item *item;
+    int active = atomic_load_explicit(&trav->active, memory_order_relaxed);
+
+    if (atomic_load(&trav->queued_chunks) >= active * MAX_QUEUED_CHUNKS_PER_THREAD
+            || (item = new_work_item(worker, scan->dir_path, strlen(scan->dir_path), &chunk->tag)) == NULL) {
+        if (handle_chunk(trav, worker, chunk, scan->dir_path) != SUCCESS) {
+            scan->status = FAILURE;
+        }
+        chunk->size = 0;
+        chunk->names_used = 0;
+        return;
+    }
+    atomic_fetch_add(&scan->self->refs, 1);
+    atomic_fetch_add(&trav->queued_chunks, 1);
+    atomic_fetch_add(&scan->root->pending, 1);  //counted before the directory is done, as sub-directories are
+    atomic_fetch_add(&trav->pending, 1);
+    add_frontier(trav, &item, 1);
+    if (!work_deque_push(trav->deques[worker->id], item)) {
+        drop_work(trav, worker, &item, 1);
+    }
+    scan->chunk = create_chunk(scan);           //without it the reader handles the rest itself
+}
+
+
+//adds an entry read from the directory being scanned to its chunk, which is queued when full
+static void add_to_chunk(Traverser *trav, Worker *worker, Dir_scan *scan, Dir_entry *dir_entry) {
+    Dir_chunk *chunk = scan->chunk;
+    size_t name_len = strlen(dir_entry->name) + 1;
+
+    memcpy(chunk->names + chunk->names_used, dir_entry->name, name_len);
+    chunk->name_offsets[chunk->size] = (int)chunk->names_used;
+    chunk->d_types[chunk->size] = dir_entry->type;
+    chunk->names_used += name_len;
+    if (++chunk->size == DIR_CHUNK_SIZE || chunk->names_used + NAME_MAX + 1 > DIR_CHUNK_NAMES_SIZE) {
+        publish_chunk(trav, worker, scan);
+    }
+}
+
+
+/**
+ * Reads the entries of the directory being scanned, and handles them. 
+ * Entries are only stat:ed when their type is unknown or the user wants 
+ * metadata, in batches through the thread's ring if it has one. Once
+ * DIR_CHUNK_THRESHOLD entries are read, the rest are handed out in chunks
+ * for all threads to stat and handle, so a huge directory is not left to
+ * the one thread reading it.
+ * 
+ * @param trav traverser
+ * @param worker calling thread, whose directory reader is opened on the directory
+ * @param scan directory being scanned
+ * @param entry entry with the fields that are the same for all entries of the directory filled in
+ * @return int 0 when all entries were read, -1 on read error
+ */
+static int read_dir(Traverser *trav, Worker *worker, Dir_scan *scan, Dwaf_entry *entry) {
+    Dir_entry dir_entry;
+    int read_status;
+    const Dwaf_filter *filter = trav->do_with_file->filter;
+
+    while (!is_aborted(trav) && (read_status = next_dir_entry(worker, &dir_entry)) > 0) {
+        if (is_navigationfile(dir_entry.name)) {
+            continue;
+        }
+        if (worker->stats != NULL) {
+            worker->stats->files++;
+        }
+        scan->entries_size++;
+        //left out on the name alone, before its path is built or it is stat:ed
+        if (filter != NULL && filter_skips_name(filter, dir_entry.name, dir_entry.type, scan->depth + 1)) {
+            continue;
+        }
+        if (scan->chunk != NULL 
+                || (scan->chunkable && scan->entries_size > DIR_CHUNK_THRESHOLD && start_chunks(trav, worker, scan))) {
+            add_to_chunk(trav, worker, scan, &dir_entry);
+            continue;
+        }
+        scan_entry(trav, worker, scan, entry, &dir_entry);
+    }
+    if (worker->batch != NULL && worker->batch->size > 0) {     //the ring may have been given up while reading
+        flush_stat_batch(trav, worker, scan);
+    }
+    if (scan->chunk != NULL) {                  //the last chunk is handled by the reader, which is done reading
+        if (scan->chunk->size > 0 && handle_chunk(trav, worker, scan->chunk, scan->dir_path) != SUCCESS) {
+            scan->status = FAILURE;
+        }
+        free(scan->chunk);
+        scan->chunk = NULL;
+    }
+    return read_status;
+}
+
+
+//handles the entries of the directory being scanned as they were cached, without reading or stat:ing anything
+static void replay_dir(Traverser *trav, Worker *worker, Dir_scan *scan, Dwaf_entry *entry, const Cache_dir *cached) {
+    const Cache_entry *entries = dir_cache_entries(cached);
+
+    if (worker->stats != NULL) {
+        worker->stats->files += cached->entries_size;
+    }
+    scan->entries_size += cached->entries_size;
+    for (uint32_t i = 0; i < cached->entries_size; i++) {
+        const char *name = dir_cache_name(cached, &entries[i]);
+        if (!path_buf_set_name(&worker->pb, scan->prefix_len, name)) {
+            fprintf(stderr, "do-with-all-files: can not traverse '%s/%s'\n", scan->dir_path, name);
+            scan->status = FAILURE;
+            continue;
+        }
+        entry->d_type = entries[i].d_type;
+        dir_cache_entry_statx(&entries[i], &entry->stx);
+        entry->stx.stx_dev_major = scan->dir_stx->stx_dev_major;   //not cached, a file is on its directory's device
+        entry->stx.stx_dev_minor = scan->dir_stx->stx_dev_minor;
+        entry->stx_mask = entry->stx.stx_mask;
+        handle_entry(trav, worker, scan, entry);
+    }
+}
+
+
+/**
+ * Enqueues sub-directories of given open directory to the calling thread's deque
+ * 
+ * Calls the function stored in the traverser on each sub-file, including
+ * sub-directories, with sub-file and argument stored in the traverser as input.
+ * Sub-files are only stat:ed (relative to the directory) when readdir does
+ * not tell their type or the user wants metadata, and their paths are built 
+ * in the thread's reused path buffer. When the thread has an io_uring, the 
+ * stat calls are submitted in batches instead of one at a time. Sub-directories
+ * are moved to the deque in batches of up to SUBDIR_BATCH_SIZE. If the user's
+ * function takes batches, it is called with the sub-files in batches that 
+ * never hold files of more than one directory. With a cache, a directory 
+ * whose times did not change since the cache was written is not read, its
+ * cached entries are handled instead. With a filter, sub-files it leaves
+ * out by name or depth are skipped before their paths are built or they are
+ * stat:ed, so left-out sub-directories are never enqueued.
+ * 
+ * @param dir_path path to directory
+ * @param fd open file descriptor of directory, closed when no longer needed
+ * @param depth depth of directory, 0 for the given files
+ * @param root given file the directory is under
+ * @param trav traverser that counts the enqueued sub-directories as pending work
+ * @param worker calling thread
+ * @return int 0 on success, anything else indicates error
+ */
+static int enqueue_sub_dirs_do_with_sub_files(char *dir_path, int fd, int depth, Root *root, Traverser *trav, Worker *worker) {
+    Dwaf_entry entry;
+    int read_status = 0;
+    unsigned int mask = trav->do_with_file->statx_mask;
+    const Cache_dir *cached = NULL;
+    struct statx dir_stx;
+    bool stamped = false;
+    long start, dir_start = trace_start(worker);
+    Dir_scan scan = {.dir_path = dir_path, .fd = fd, .depth = depth, .root = root, .self = NULL, 
+                        .entries_size = 0, .dir_stx = NULL, .recording = false, .chunkable = true, .chunk = NULL, 
+                        .status = SUCCESS};
+
+    if ((scan.prefix_len = path_buf_set_dir(&worker->pb, dir_path)) == 0 || !dir_reader_open(worker->dr, fd)) {
+        fprintf(stderr, "do-with-all-files: cannot read files in directory '%s'\n", dir_path); 
+        close(fd);
+        return FAILURE;
+    }
+    entry.parent_fd = fd;
+    entry.name_offset = (int)scan.prefix_len;
+    entry.depth = depth + 1;
+    entry.root_index = root->index;
+    if (worker->stats != NULL) {
+        worker->stats->dirs++;
+    }
+
+    //one stat of the directory tells if its cached entries can be used instead of reading it
+    if (trav->cache != NULL || trav->cache_out != NULL) {
+        start = op_start(worker);
+        stamped = statx(fd, "", AT_EMPTY_PATH, DIR_CACHE_STAMP_MASK, &dir_stx) == 0
+                    && (dir_stx.stx_mask & DIR_CACHE_STAMP_MASK) == DIR_CACHE_STAMP_MASK;
+        op_end(worker, DWAF_OP_STATX, start);
+    }
+    if (stamped) {
+        scan.dir_stx = &dir_stx;
+        if (trav->cache != NULL) {
+            cached = dir_cache_find(trav->cache, &dir_stx, mask);
+        }
+        if (trav->cache_out != NULL && cached != NULL) {
+            cache_writer_copy_dir(trav->cache_out, worker->id, cached);
+        } else if (trav->cache_out != NULL) {
+            cache_writer_begin_dir(trav->cache_out, worker->id, &dir_stx, mask);
+            scan.recording = true;
+        }
+    }
+
+    if (cached != NULL) {
+        replay_dir(trav, worker, &scan, &entry, cached);
+    } else {
+        read_status = read_dir(trav, worker, &scan, &entry);
+    }
+    deliver_batch(worker, trav->do_with_file, worker->out);     //while the directory is still open for parent_fd
+    push_subdirs(trav, worker, root);
+    
+    if (read_status < 0) {
+        fprintf(stderr, "do-with-all-files: cannot read files in directory '%s'\n", dir_path); 
+        scan.status = FAILURE;
+    }
+    if (scan.recording) {       //a directory cut short by an abort is not recorded
+        cache_writer_end_dir(trav->cache_out, worker->id, scan.status == SUCCESS && !is_aborted(trav));
+    }
+
+    dir_reader_close(worker->dr);
+    trace_end(worker, TRACE_DIR, dir_start, dir_path, scan.entries_size);
+    if (scan.self == NULL || scan.self->fd < 0) {
+        start = trace_start(worker);
+        close(fd);
+        trace_end(worker, TRACE_CLOSE, start, NULL, 0);
+    }
+    release_dir(trav, scan.self);           //closes held fd when the last sub-directory has been opened
+
+    return scan.status;   
+}
+
+
+/**
+ * Calls the function stored in the traverser with one of the given files 
+ * and argument stored in the traverser as input. Sub-files of directories
+ * are done when their parent directory is read, so this is only needed
+ * for the files the traversal starts from.
+ * 
+ * @param trav traverser storing users function and argument
+ * @param worker calling thread
+ * @param root given file
+ * @param fd open file descriptor of file if it is a directory, else negative
+ * @param open_errno why file could not be opened as a directory
+ * @param descend set to false if the user's function asked not to read the directory
+ * @return int 0 on success, anything else indicates an error
+ */
+static int do_to_given_file(Traverser *trav, Worker *worker, Root *root, int fd, int open_errno, bool *descend) {
+    Func_and_arg *func_and_arg = trav->do_with_file;
+    char *file_path = root->path;
+    Dwaf_entry entry = {.path = file_path, .name_offset = 0, .parent_fd = AT_FDCWD, .depth = 0, 
+                        .root_index = root->index, .d_type = fd >= 0 ? DT_DIR : DT_UNKNOWN, .stx_mask = 0};
+    unsigned int mask = func_and_arg->statx_mask;
+    bool stat_ok;
+
+    if (fd < 0) {
+        stat_ok = fetch_statx(worker, AT_FDCWD, file_path, 0, mask | STATX_TYPE, &entry);
+    } else {
+        stat_ok = mask == 0 || fetch_statx(worker, fd, "", AT_EMPTY_PATH, mask, &entry);
+    }
+    if (!stat_ok) {
+        fprintf(stderr, "do-with-all-files: can not traverse '%s'\n", file_path);
+        return FAILURE;
+    }
+
+    if (is_first_link(trav, &entry)) {
+        Dwaf_action action = deliver(worker, func_and_arg, worker->state, &entry);
+        if (action == DWAF_ABORT) {
+            atomic_store(&trav->aborted, true);
+        }
+        *descend = action == DWAF_CONTINUE;
+    }
+
+    if (fd < 0 && open_errno != ENOTDIR && open_errno != ELOOP) {     //a directory that can not be opened
+        fprintf(stderr, "do-with-all-files: cannot read files in directory '%s'\n", file_path); 
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/**
+ * Traverses a dequeued directory: pushes its sub-directories to the calling 
+ * thread's deque and does the function stored in the traverser to all its 
+ * sub-files. If directory is one of the given files, the function is first 
+ * done to it.
+ * 
+ * @param trav traverser storing users function and argument
+ * @param worker calling thread
+ * @param file_path 
+ * @param parent parent directory, the never open reference of its root if file is one of the given files
+ * @param fd directory opened with open_dir, negative if it could not be opened
+ * @param open_errno why directory could not be opened
+ * @return int 0 on success, anything else indicates an error
+ */
+static int do_to_file_and_push_subdirs(Traverser *trav, Worker *worker, char *file_path, Dir_ref *parent, int fd, int open_errno) {
+    int depth = parent->depth + 1;
+    Root *root = parent->root;
+    bool descend = true;
+
+    release_dir(trav, parent);
+
+    if (depth == 0) {
+        if (do_to_given_file(trav, worker, root, fd, open_errno, &descend) != SUCCESS) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return FAILURE;
+        }
+    } else if (fd < 0) {
+        fprintf(stderr, "do-with-all-files: cannot read files in directory '%s'\n", file_path); 
+        return FAILURE;
+    }
+
+    if (fd >= 0 && (!descend || is_aborted(trav) 
+            || (trav->do_with_file->filter != NULL && filter_prunes(trav->do_with_file->filter, depth)))) {
+        close(fd);
+        return SUCCESS;
+    }
+    if (fd >= 0) {
+        return enqueue_sub_dirs_do_with_sub_files(file_path, fd, depth, root, trav, worker);
+    }
+    return SUCCESS;
+}
+
+
+//tells if the thread reads the oldest of its queued directories next, rather than the newest
+static bool pops_oldest(Traverser *trav) {
+    switch (trav->do_with_file->order) {
+        case DWAF_BREADTH_FIRST:
+            return true;
+        case DWAF_HYBRID:
+            return atomic_load_explicit(&trav->frontier_bytes, memory_order_relaxed) < trav->do_with_file->frontier_limit;
+        default:
+            return false;
+    }
+}
+
+
+//pops up to max of the thread's own queued directories (or chunks), in the order of the traversal
+static int pop_own(Traverser *trav, Worker *worker, Work_item **items, int max) {
+    Work_deque *dq = trav->deques[worker->id];
+
+    return pops_oldest(trav) ? work_deque_pop_oldest_batch(dq, items, max) : work_deque_pop_batch(dq, items, max);
+}
+
+
+//handles a dequeued chunk of a huge directory's entries, or drops it unhandled after an abort
+static void traverse_chunk(Traverser *trav, Worker *worker, Work_item *item) {
+    Dir_chunk *chunk = item->data;
+    Root *root = chunk->tag.root;
+    int status = SUCCESS;
+
+    if (!is_aborted(trav)) {
+        status = handle_chunk(trav, worker, chunk, item->path);
+    }
+    recycle_work_item(trav, worker, item);
+    release_chunk(trav, chunk);
+    finish_work(trav, root, status != SUCCESS);
+}
+
+
+/**
+ * Pops up to OPEN_BATCH_SIZE directories from the calling thread's deque 
+ * and opens them all with one submission to the thread's ring. The 
+ * directories are then traversed one by one.
+ * 
+ * @param trav traverser
+ * @param worker calling thread, which must have a ring
+ * @param first directory already popped
+ */
+static void traverse_open_batch(Traverser *trav, Worker *worker, Work_item *first) {
+    char *paths[OPEN_BATCH_SIZE];
+    Dir_ref *parents[OPEN_BATCH_SIZE];
+    int results[OPEN_BATCH_SIZE];
+    int size = 0, completed = 0;
+    bool submitted = true;
+    Work_item *items[OPEN_BATCH_SIZE];
+    int popped;
+
+    items[0] = first;
+    popped = pop_own(trav, worker, items + 1, OPEN_BATCH_SIZE - 1);
+    size = 1;
+    for (int i = 1; i <= popped; i++) {         //chunks popped with the directories are handled at once
+        if (is_chunk(items[i])) {
+            traverse_chunk(trav, worker, items[i]);
+        } else {
+            items[size++] = items[i];
+        }
+    }
+    for (int i = 0; i < size; i++) {
+        paths[i] = items[i]->path;
+        parents[i] = items[i]->data;
+    }
+
+    for (int i = 0; i < size; i++) {
+        bool by_path = parents[i]->fd < 0;
+        results[i] = -EIO;
+        submitted = submitted && uring_queue_openat(worker->ring, by_path ? AT_FDCWD : parents[i]->fd, 
+                                    by_path ? paths[i] : strrchr(paths[i], '/') + 1,
+                                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC, (uint64_t)i);
+    }
+    if (worker->stats != NULL) {
+        worker->stats->syscalls += size;
+    }
+    submitted = submitted && submit_and_wait(worker, (unsigned int)size);
+    while (submitted && completed < size) {
+        uint64_t index;
+        int res;
+        if (uring_next_completion(worker->ring, &index, &res)) {
+            results[index] = res;
+            completed++;
+        } else if (!submit_and_wait(worker, (unsigned int)(size - completed))) {
+            submitted = false;
+        }
+    }
+    if (!submitted) {
+        give_up_ring(worker, true);
+    }
+
+    for (int i = 0; i < size; i++) {
+        int fd = results[i], open_errno = fd < 0 ? -fd : 0, status;
+        Root *root = parents[i]->root;
+        if (!submitted) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            fd = open_dir(worker, parents[i], paths[i]);
+            open_errno = errno;
+        }
+        status = do_to_file_and_push_subdirs(trav, worker, paths[i], parents[i], fd, open_errno);
+        recycle_work_item(trav, worker, items[i]);
+        finish_work(trav, root, status != SUCCESS);
+    }
+}
+
+
+/**
+ * Tries to steal directories from the other threads' deques, starting with
+ * the thread after the calling one. Up to half of the first non-empty deque
+ * is stolen at once: one directory is returned, the rest are moved to the 
+ * calling thread's deque. 
+ * 
+ * @param trav traverser
+ * @param worker calling thread
+ * @return Work_item* stolen directory, NULL if there was nothing to steal
+ */
+static Work_item *steal_work(Traverser *trav, Worker *worker) {
+    Work_item *stolen[STEAL_BATCH_SIZE];
+    int n;
+    long start = trace_start(worker);
+
+    int started = atomic_load_explicit(&trav->started, memory_order_acquire);
+
+    for (int i = 1; i < started; i++) {
+        if ((n = work_deque_steal_batch(trav->deques[(worker->id + i) % started], stolen, STEAL_BATCH_SIZE)) > 0) {
+            if (n > 1 && !work_deque_push_batch(trav->deques[worker->id], stolen + 1, n - 1)) {
+                drop_work(trav, worker, stolen + 1, n - 1);
+            }
+            trace_end(worker, TRACE_STEAL, start, NULL, n);
+            return stolen[0];
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Lets an idle thread back off, first by yielding and then
+ * by sleeping for longer and longer (up to a limit). 
+ * 
+ * @param idle_rounds number of times in a row the thread found no work
+ */
+static void back_off(int idle_rounds) {
+    if (idle_rounds < SPINS_BEFORE_SLEEP) {
+        sched_yield();
+        return;
+    }
+
+    long sleep_ns = 1000L << ((idle_rounds - SPINS_BEFORE_SLEEP) < 10 ? (idle_rounds - SPINS_BEFORE_SLEEP) : 10);
+    struct timespec nap = {0, sleep_ns < MAX_IDLE_SLEEP_NS ? sleep_ns : MAX_IDLE_SLEEP_NS};
+    nanosleep(&nap, NULL);
+}
+
+
+static bool start_threads(Dwaf_context *ctx, int wanted);
+
+/**
+ * Tunes how many threads take work, from what the threads did since
+ * the last tuning. Threads looking for work a large part of the time 
+ * means there are more threads than work, so some are parked. Threads
+ * mostly waiting for I/O while directories queue up means the storage
+ * can take more requests at once, so more threads are let in, unless
+ * the CPUs are already busy: then the waiting is for a CPU, not for I/O, 
+ * and threads beyond the number of CPUs only take turns.
+ * Called by one thread at a time.
+ * 
+ * @param ctx context
+ * @param now current time
+ */
+static void tune_threads(Dwaf_context *ctx, long now) {
+    Traverser *trav = ctx->trav;
+    int started = atomic_load(&trav->started);
+    int active = atomic_load(&trav->active);
+    int wanted = active;
+    long busy = 0, cpu = 0, idle = 0;
+    long d_busy, d_cpu, d_idle, d_wall;
+    long backlog = atomic_load(&trav->pending) - active;
+
+    for (int i = 0; i < started; i++) {
+        busy += atomic_load_explicit(&ctx->workers[i].busy_ns, memory_order_relaxed);
+        cpu += atomic_load_explicit(&ctx->workers[i].cpu_ns, memory_order_relaxed);
+        idle += atomic_load_explicit(&ctx->workers[i].idle_ns, memory_order_relaxed);
+    }
+    d_busy = busy - trav->tuned_busy_ns;
+    d_cpu = cpu - trav->tuned_cpu_ns;
+    d_idle = idle - trav->tuned_idle_ns;
+    d_wall = now - trav->tuned_ns;
+    trav->tuned_busy_ns = busy;
+    trav->tuned_cpu_ns = cpu;
+    trav->tuned_idle_ns = idle;
+    trav->tuned_ns = now;
+    if (d_busy <= 0 || d_wall <= 0) {
+        return;
+    }
+
+    if (d_idle * 4 > d_busy + d_idle) {                                 //a quarter of the time without work
+        wanted = active - (active / 4 > 1 ? active / 4 : 1);
+    } else if (d_cpu * 5 > d_wall * trav->cpus * 4) {                   //CPUs busy
+        if (active > trav->cpus) {
+            wanted = active - (active / 4 > 1 ? active / 4 : 1);
+            wanted = wanted > trav->cpus ? wanted : trav->cpus;
+        }
+    } else if (d_cpu * 2 < d_busy && backlog > active) {                //mostly waiting for I/O, with work for more threads
+        wanted = active + (active / 2 > 1 ? active / 2 : 1);
+    }
+    wanted = wanted < 1 ? 1 : wanted < trav->thread_size ? wanted : trav->thread_size;
+    if (wanted > started && !start_threads(ctx, wanted)) {
+        wanted = atomic_load(&trav->started);
+    }
+    atomic_store_explicit(&trav->active, wanted, memory_order_relaxed);
+}
+
+
+//adds the time the thread spent on the directory it is done with, and tunes the number of active threads when it is time to
+static void account_busy_time(Worker *worker, long busy_start, long cpu_start) {
+    Traverser *trav = worker->ctx->trav;
+    long now = clock_ns(CLOCK_MONOTONIC);
+
+    atomic_fetch_add_explicit(&worker->busy_ns, now - busy_start, memory_order_relaxed);
+    atomic_fetch_add_explicit(&worker->cpu_ns, clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start, memory_order_relaxed);
+    if (now < atomic_load_explicit(&trav->next_tune_ns, memory_order_relaxed) 
+            || atomic_exchange(&trav->tuning, true)) {
+        return;
+    }
+    if (now >= atomic_load(&trav->next_tune_ns)) {
+        atomic_store(&trav->next_tune_ns, now + TUNE_INTERVAL_NS);
+        tune_threads(worker->ctx, now);
+    }
+    atomic_store(&trav->tuning, false);
+}
+
+
+/**
+ * Work-loop for one thread. The thread pops directories, and chunks of
+ * huge directories' entries, from its own deque, and steals from the other
+ * threads' deques when its own is empty. 
+ * The directories may be under any of the given files, so no thread waits
+ * for one given file to be done before working on the next.
+ * Traversal is finished when the traverser's count of pending directories 
+ * reaches 0, which can only happen when no thread holds or can make more work.
+ * Once the user's function aborts the traversal, directories are dropped as
+ * they are popped instead of read, so the count drops to 0 without more I/O.
+ * 
+ * @param trav traverser-struct 
+ * @param worker calling thread
+ */
+static void traverse_files(Traverser *trav, Worker *worker) {
+    Work_item *item;
+    Dir_ref *parent;
+    Root *root;
+    int fd, open_errno, status;
+    int idle_rounds = 0;
+    long busy_start = 0, cpu_start = 0, idle_start;
+    long idle_since = 0;                                //start of the idle span being traced, 0 if none
+    bool was_parked = false;
+    unsigned long long lock_wait_start = work_deque_lock_wait_ns();
+    
+    while (1) {        
+        bool parked = worker->id >= atomic_load_explicit(&trav->active, memory_order_relaxed);
+
+        if (parked || (pop_own(trav, worker, &item, 1) == 0 && (item = steal_work(trav, worker)) == NULL)) {
+            if (worker->trace != NULL && (idle_since == 0 || was_parked != parked)) {
+                if (idle_since != 0) {
+                    trace_end(worker, TRACE_IDLE, idle_since, NULL, was_parked);
+                }
+                idle_since = clock_ns(CLOCK_MONOTONIC);
+                was_parked = parked;
+            }
+            if (atomic_load(&trav->pending) == 0) {
+                break;                                  //work is no more
+            }
+            if (parked) {                               //its deque is left to the active threads to steal from
+                back_off(SPINS_BEFORE_SLEEP + 10);
+                continue;
+            }
+            idle_start = trav->adaptive || worker->stats != NULL ? clock_ns(CLOCK_MONOTONIC) : 0;
+            back_off(idle_rounds++);                    //someone is still at work and may make more work
+            if (trav->adaptive) {
+                atomic_fetch_add_explicit(&worker->idle_ns, clock_ns(CLOCK_MONOTONIC) - idle_start, memory_order_relaxed);
+            }
+            if (worker->stats != NULL) {
+                worker->stats->idle_ns += clock_ns(CLOCK_MONOTONIC) - idle_start;
+            }
+            continue;
+        }
+        idle_rounds = 0;
+        if (idle_since != 0) {
+            trace_end(worker, TRACE_IDLE, idle_since, NULL, was_parked);
+            idle_since = 0;
+        }
+        parent = item->data;
+        root = parent->root;
+
+        if (is_aborted(trav) && !is_chunk(item)) {    //dropped unread, only counted as done
+            recycle_work_item(trav, worker, item);
+            release_dir(trav, parent);
+            finish_work(trav, root, false);
+            continue;
+        }
+
+        if (trav->adaptive) {
+            busy_start = clock_ns(CLOCK_MONOTONIC);
+            cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        }
+        if (is_chunk(item)) {
+            traverse_chunk(trav, worker, item);
+        } else if (worker->ring != NULL && parent->depth >= 0) {
+            traverse_open_batch(trav, worker, item);
+        } else {
+            fd = open_dir(worker, parent, item->path);
+            open_errno = errno;
+            status = do_to_file_and_push_subdirs(trav, worker, item->path, parent, fd, open_errno);
+            recycle_work_item(trav, worker, item);
+            finish_work(trav, root, status != SUCCESS);
+        }
+        if (trav->adaptive) {
+            account_busy_time(worker, busy_start, cpu_start);
+        }
+    }
+    if (idle_since != 0) {
+        trace_end(worker, TRACE_IDLE, idle_since, NULL, was_parked);
+    }
+    if (worker->stats != NULL) {
+        worker->stats->lock_ns += work_deque_lock_wait_ns() - lock_wait_start;
+    }
+}
+
+
+
+static Entry_batch *create_Entry_batch(int batch_size);
+static void destroy_Entry_batch(Entry_batch *out);
+
+//frees the buffers the thread reuses for every traversal
+static void free_worker_buffers(Worker *worker) {
+    free(worker->pb.str);
+    if (worker->out != NULL) {
+        destroy_Entry_batch(worker->out);
+    }
+    if (worker->dr != NULL) {
+        dir_reader_destroy(worker->dr);
+    }
+    if (worker->ring != NULL) {
+        uring_destroy(worker->ring);
+        free(worker->batch);
+    }
+    if (worker->arena != NULL) {
+        arena_destroy(worker->arena);
+    }
+}
+
+
+//sets up the buffers the thread reuses for every traversal, and an io_uring if it is compiled in and the kernel allows it
+static bool set_up_worker(Worker *worker, Dwaf_context *ctx, int id) {
+    worker->ctx = ctx;
+    worker->id = id;
+    if ((worker->arena = arena_create(ARENA_CHUNK_SIZE)) == NULL
+            || (worker->dr = dir_reader_create(DIR_READER_BUF_SIZE)) == NULL) {
+        return false;
+    }
+    if ((worker->ring = uring_create(URING_ENTRIES)) != NULL 
+            && (worker->batch = malloc(sizeof(Stat_batch))) == NULL) {
+        uring_destroy(worker->ring);
+        worker->ring = NULL;
+    }
+    if (worker->batch != NULL) {
+        worker->batch->size = 0;
+        worker->batch->names_used = 0;
+    }
+    return true;
+}
+
+
+//the thread's own reducer state, on cache lines of its own so threads do not slow each other down
+static void *create_reducer_state(Func_and_arg *func_and_arg) {
+    size_t size = (func_and_arg->reducer.state_size + CACHE_LINE_SIZE) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    void *state;
+
+    if ((state = aligned_alloc(CACHE_LINE_SIZE, size)) == NULL) {
+        return NULL;
+    }
+    memset(state, 0, size);
+    if (func_and_arg->reducer.init != NULL) {
+        func_and_arg->reducer.init(state, func_and_arg->arg);
+    }
+    return state;
+}
+
+
+//sets up what the thread needs for the job's function, returns false if it can not take part in the job
+static bool set_up_worker_for_job(Worker *worker, Func_and_arg *func_and_arg) {
+    if (func_and_arg->do_with_batch != NULL 
+            && (worker->out == NULL || worker->out->capacity < func_and_arg->batch_size)) {
+        if (worker->out != NULL) {
+            destroy_Entry_batch(worker->out);
+        }
+        if ((worker->out = create_Entry_batch(func_and_arg->batch_size)) == NULL) {
+            return false;
+        }
+    }
+    if (func_and_arg->reducer.accumulate != NULL 
+            && (worker->state = create_reducer_state(func_and_arg)) == NULL) {
+        return false;
+    }
+    if (func_and_arg->stats != NULL) {
+        worker->stats = calloc(1, sizeof(Dwaf_thread_stats));   //without it the thread still works, uncounted
+    }
+    if (worker->ctx->trav->trace != NULL) {
+        worker->trace = trace_buf(worker->ctx->trav->trace, worker->id);
+    }
+    return true;
+}
+
+
+/**
+ * Makes job the one the context's threads work on: the given files
+ * are spread over the active threads' deques, so every thread starts 
+ * with one if there are enough. Must be called with the context's lock held, 
+ * when no job is being worked on.
+ * 
+ * @param ctx context
+ * @param job job to start
+ */
+static void start_job(Dwaf_context *ctx, Dwaf_job *job) {
+    Traverser *trav = ctx->trav;
+    Options *opts = job->opts;
+    int seed_size;                                  //threads given the files
+
+    trav->do_with_file = opts->do_with_file;
+    atomic_store(&trav->pending, 0);
+    atomic_store(&trav->failed, false);
+    atomic_store(&trav->aborted, false);
+    atomic_store(&trav->frontier_bytes, 0);
+    if (opts->do_with_file->stats != NULL || opts->do_with_file->trace_path != NULL) {
+        trav->started_ns = clock_ns(CLOCK_MONOTONIC);
+    }
+    if (opts->do_with_file->trace_path != NULL && (trav->trace = trace_create(ctx->thread_size, trav->started_ns)) == NULL) {
+        fprintf(stderr, "do-with-all-files: can not trace to '%s'\n", opts->do_with_file->trace_path);
+        opts->success_status = FAILURE;
+    }
+    if (trav->adaptive) {                           //the number of active threads learned by earlier jobs is kept
+        long busy = 0, cpu = 0, idle = 0;
+        for (int i = 0; i < ctx->started_size; i++) {
+            busy += atomic_load(&ctx->workers[i].busy_ns);
+            cpu += atomic_load(&ctx->workers[i].cpu_ns);
+            idle += atomic_load(&ctx->workers[i].idle_ns);
+        }
+        trav->tuned_busy_ns = busy;
+        trav->tuned_cpu_ns = cpu;
+        trav->tuned_idle_ns = idle;
+        trav->tuned_ns = clock_ns(CLOCK_MONOTONIC);
+        atomic_store(&trav->next_tune_ns, trav->tuned_ns + TUNE_INTERVAL_NS);
+    }
+    seed_size = atomic_load(&trav->active) < ctx->started_size ? atomic_load(&trav->active) : ctx->started_size;
+    if (opts->do_with_file->cache_path != NULL) {
+        trav->cache = dir_cache_open(opts->do_with_file->cache_path);      //NULL the first time, all is then read
+        if ((trav->cache_out = cache_writer_create(opts->do_with_file->cache_path, ctx->thread_size)) == NULL) {
+            fprintf(stderr, "do-with-all-files: can not write cache '%s'\n", opts->do_with_file->cache_path);
+            opts->success_status = FAILURE;
+        }
+    }
+    if (opts->do_with_file->dedup_hardlinks && (trav->inodes = inode_set_create()) == NULL) {
+        fprintf(stderr, "do-with-all-files: can not tell hard links apart, files with several links are given for each\n");
+        opts->success_status = FAILURE;
+    }
+
+    for (int i = 0; i < opts->files_size; i++){     
+        Root *root = &opts->roots[i];
+        Work_item *top_dir;
+
+        root->path = opts->files[i];
+        root->index = i;
+        root->above.fd = -1;
+        root->above.depth = -1;
+        root->above.root = root;
+        atomic_init(&root->above.refs, 1);
+        atomic_init(&root->pending, 1);
+        atomic_init(&root->failed, false);
+        if ((top_dir = make_work_item(ctx->arena, root->path, strlen(root->path), &root->above)) == NULL
+                || !work_deque_push(trav->deques[i % seed_size], top_dir)) {
+            atomic_store(&root->failed, true);
+            report_root(trav, root);                //not counted in pending, so reported here
+            opts->success_status = FAILURE;
+            continue;
+        }
+        atomic_fetch_add(&trav->pending, 1);
+    }
+
+    ctx->current = job;
+    ctx->generation++;
+    ctx->working = ctx->started_size;
+    pthread_cond_broadcast(&ctx->work_ready);
+}
+
+
+/**
+ * Finishes the current job of the context, called by the last thread 
+ * done with it. The threads' reducer states are merged one at a time,
+ * everything allocated for the job is given back at once, and the next
+ * submitted job, if any, is started.
+ * 
+ * @param ctx context
+ */
+static void finish_job(Dwaf_context *ctx) {
+    Dwaf_job *job = ctx->current;               //the other threads wait for the next job, so nothing here is shared
+    Options *opts = job->opts;
+    int status = opts->success_status;
+    Dwaf_stats *stats = opts->do_with_file->stats;
+
+    if (stats != NULL) {
+        stats->wall_ns = clock_ns(CLOCK_MONOTONIC) - ctx->trav->started_ns;
+        memset(&stats->total, 0, sizeof(Dwaf_thread_stats));
+        stats->threads_size = 0;
+        if ((stats->threads = calloc(ctx->started_size, sizeof(Dwaf_thread_stats))) != NULL) {
+            stats->threads_size = ctx->started_size;
+        }
+    }
+    if (ctx->trav->trace != NULL) {              //written before the arenas holding the paths are reset
+        if (!trace_write(ctx->trav->trace, opts->do_with_file->trace_path)) {
+            fprintf(stderr, "do-with-all-files: can not write trace '%s'\n", opts->do_with_file->trace_path);
+            status = FAILURE;
+        }
+        trace_destroy(ctx->trav->trace);
+        ctx->trav->trace = NULL;
+    }
+    for (int i = 0; i < ctx->started_size; i++) {
+        Worker *worker = &ctx->workers[i];
+        if (worker->stats != NULL) {
+            if (stats->threads != NULL) {
+                stats->threads[i] = *worker->stats;
+            }
+            stats_add(&stats->total, worker->stats);
+            free(worker->stats);
+            worker->stats = NULL;
+        }
+        worker->trace = NULL;
+        if (worker->state != NULL) {
+            if (opts->do_with_file->reducer.merge != NULL) {
+                opts->do_with_file->reducer.merge(worker->state, opts->do_with_file->arg);
+            }
+            free(worker->state);
+            worker->state = NULL;
+        }
+        memset(worker->free_items, 0, sizeof(worker->free_items));     //they are in the arena
+        arena_reset(worker->arena);
+    }
+    arena_reset(ctx->arena);
+    if (atomic_load(&ctx->trav->failed)) {
+        status = FAILURE;
+    }
+    if (ctx->trav->cache_out != NULL) {
+        if (!cache_writer_commit(ctx->trav->cache_out)) {
+            fprintf(stderr, "do-with-all-files: can not write cache '%s'\n", opts->do_with_file->cache_path);
+            status = FAILURE;
+        }
+        cache_writer_destroy(ctx->trav->cache_out);
+        ctx->trav->cache_out = NULL;
+    }
+    if (ctx->trav->cache != NULL) {
+        dir_cache_close(ctx->trav->cache);
+        ctx->trav->cache = NULL;
+    }
+    if (ctx->trav->inodes != NULL) {
+        inode_set_destroy(ctx->trav->inodes);
+        ctx->trav->inodes = NULL;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    job->status = status;
+    job->done = true;
+    ctx->current = NULL;
+    if (ctx->queue_head != NULL) {
+        Dwaf_job *next = ctx->queue_head;
+        if ((ctx->queue_head = next->next) == NULL) {
+            ctx->queue_tail = NULL;
+        }
+        start_job(ctx, next);
+    }
+    pthread_cond_broadcast(&ctx->job_done);
+    pthread_cond_broadcast(&ctx->work_ready);   //lets threads waiting to quit see there is no job left
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+
+/**
+ * Work-loop of one thread of a context. The thread waits for a job, 
+ * traverses its files together with the other threads, and the last 
+ * thread done finishes the job. The thread quits when the context is
+ * destroyed and no job is left.
+ * 
+ * @param arg worker-struct
+ * @return NULL
+ */
+static void *traverse_directories(void *arg) {
+    Worker *worker = (Worker*)arg;
+    Dwaf_context *ctx = worker->ctx;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (1) {
+        Dwaf_job *job;
+
+        while (!ctx->quit && (ctx->current == NULL || ctx->generation == worker->generation)) {
+            pthread_cond_wait(&ctx->work_ready, &ctx->lock);
+        }
+        if (ctx->current == NULL || ctx->generation == worker->generation) {
+            break;                                  //told to quit, and no job left
+        }
+        job = ctx->current;
+        worker->generation = ctx->generation;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (set_up_worker_for_job(worker, job->opts->do_with_file)) {
+            traverse_files(ctx->trav, worker);
+        } else {
+            fprintf(stderr, "do-with-all-files: can not allocate memory for thread\n");
+            job->opts->success_status = FAILURE;    //the other threads still do the work
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+        if (--ctx->working == 0) {
+            pthread_mutex_unlock(&ctx->lock);
+            finish_job(ctx);
+            pthread_mutex_lock(&ctx->lock);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+
+
+//------------------------------creation and destruction of structs--------------------------------//
+
+static void destroy_Traverser(Traverser *trav);
+
+//half of the file descriptors left when each thread reads one directory (two descriptors), the rest is left to the user
+static int max_held_fds(int thread_size) {
+    struct rlimit lim;
+    long spare;
+    if (getrlimit(RLIMIT_NOFILE, &lim) != 0) {
+        return 0;
+    }
+    if (lim.rlim_cur == RLIM_INFINITY || lim.rlim_cur > 131072) {
+        return 65536;
+    }
+    spare = (long)lim.rlim_cur - 2L * thread_size - 16;
+    return spare > 0 ? (int)(spare / 2) : 0;
+}
+
+static Traverser *create_Traverser(int thread_size) {
+    Traverser *trav;
+    if ((trav = calloc(1, sizeof(Traverser))) == NULL) {
+        return NULL;
+    }
+    trav->thread_size = thread_size;
+    if ((trav->deques = calloc(thread_size, sizeof(Work_deque*))) == NULL) {
+        free(trav);
+        return NULL;
+    }
+    for (int i = 0; i < thread_size; i++) {
+        if ((trav->deques[i] = work_deque_create()) == NULL) {
+            destroy_Traverser(trav);
+            return NULL;
+        }
+    }
+
+    atomic_init(&trav->pending, 0);
+    atomic_init(&trav->failed, false);
+    atomic_init(&trav->held_fds, 0);
+    atomic_init(&trav->queued_chunks, 0);
+    atomic_init(&trav->frontier_bytes, 0);
+    trav->max_held_fds = max_held_fds(thread_size);
+    
+    return trav;
+}
+
+
+static Entry_batch *create_Entry_batch(int batch_size) {
+    Entry_batch *out;
+    if ((out = calloc(1, sizeof(Entry_batch))) == NULL) {
+        return NULL;
+    }
+    if ((out->entries = malloc(batch_size * sizeof(Dwaf_entry))) == NULL
+            || (out->path_offsets = malloc(batch_size * sizeof(size_t))) == NULL) {
+        destroy_Entry_batch(out);
+        return NULL;
+    }
+    out->capacity = batch_size;
+    return out;
+}
+
+
+static void destroy_Entry_batch(Entry_batch *out) {
+    free(out->entries);
+    free(out->path_offsets);
+    free(out->paths.str);
+    free(out);
+}
+
+
+static void destroy_Func_and_arg(Func_and_arg *func_and_arg) {
+    if (func_and_arg != NULL) {
+        free(func_and_arg->cache_path);
+        free(func_and_arg->trace_path);
+    }
+    free(func_and_arg);
+    func_and_arg = NULL;
+}
+
+
+static void destroy_Traverser(Traverser *trav) {
+    for (int i = 0; i < trav->thread_size; i++) {
+        if (trav->deques[i] != NULL) {
+            work_deque_destroy(trav->deques[i]);
+        }
+    }
+    free(trav->deques);
+    free(trav);
+}
+
+
+static Func_and_arg *create_Func_and_arg(void (*do_with_file)(char *file_path, void *arg), 
+                                        void (*do_with_entry)(Dwaf_entry *entry, void *arg), void *arg, unsigned int statx_mask) {
+    Func_and_arg *func_and_arg;
+    if ((func_and_arg = calloc(1, sizeof(Func_and_arg))) == NULL) {
+        return NULL;
+    }
+    func_and_arg->do_with_file = do_with_file;
+    func_and_arg->do_with_entry = do_with_entry;
+    func_and_arg->arg = arg;
+    func_and_arg->statx_mask = statx_mask;
+    return func_and_arg;
+}
+
+
+static void destroy_Options(Options *opts) {
+    if (opts != NULL) {
+        destroy_Func_and_arg(opts->do_with_file);
+        free(opts->roots);
+        free(opts);
+    }
+}
+
+//returns NULL if options could not be created, given function-and-argument is then destroyed
+static Options *create_Options(int files_size, char **files, Func_and_arg *func_and_arg) {
+    Options *user_opts;
+
+    if ((user_opts = calloc(1, sizeof(Options))) == NULL) {
+        destroy_Func_and_arg(func_and_arg);
+        return NULL;
+    }
+
+    user_opts->do_with_file = func_and_arg;
+    user_opts->files = files;
+    user_opts->files_size = files_size;   
+    atomic_init(&user_opts->success_status, SUCCESS); 
+    
+    if ((user_opts->roots = calloc(files_size > 0 ? files_size : 1, sizeof(Root))) == NULL) {
+        destroy_Options(user_opts);
+        return NULL;
+    }
+
+    return user_opts;
+}
+
+
+/**
+ * Starts threads of an adaptive context while it works on a job, until
+ * wanted threads are started. The new threads join the current job.
+ * No threads are started once the context is being destroyed.
+ * 
+ * @param ctx context
+ * @param wanted number of threads wanted
+ * @return true if wanted threads are started
+ */
+static bool start_threads(Dwaf_context *ctx, int wanted) {
+    bool started;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (!ctx->quit && ctx->started_size < wanted) {
+        Worker *worker = &ctx->workers[ctx->started_size];
+        if (!set_up_worker(worker, ctx, ctx->started_size)
+                || pthread_create(&ctx->threads[ctx->started_size], NULL, traverse_directories, (void*)worker) != 0) {
+            free_worker_buffers(worker);
+            memset(worker, 0, sizeof(Worker));      //set up from scratch if tried again
+            break;
+        }
+        ctx->started_size++;
+        ctx->working++;
+        atomic_store(&ctx->trav->started, ctx->started_size);
+    }
+    started = ctx->started_size >= wanted;
+    pthread_mutex_unlock(&ctx->lock);
+    return started;
+}
+
+
+//number of CPUs that can run the threads
+static int cpu_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+
+Dwaf_context *dwaf_context_create(int num_threads) {
+    Dwaf_context *ctx;
+    int cpus = cpu_count();
+    int first_size = num_threads;                   //threads started now
+
+    if (num_threads < 0 || (ctx = calloc(1, sizeof(Dwaf_context))) == NULL) {
+        return NULL;
+    }
+    if (num_threads == DWAF_ADAPTIVE_THREADS) {
+        num_threads = cpus * ADAPTIVE_THREADS_PER_CPU;
+        num_threads = num_threads < ADAPTIVE_MIN_THREADS ? ADAPTIVE_MIN_THREADS 
+                    : num_threads > ADAPTIVE_MAX_THREADS ? ADAPTIVE_MAX_THREADS : num_threads;
+        num_threads = num_threads > cpus ? num_threads : cpus;
+        first_size = cpus;
+    }
+    ctx->thread_size = num_threads;
+    if (pthread_mutex_init(&ctx->lock, NULL) != 0) {
+        free(ctx);
+        return NULL;
+    }
+    pthread_cond_init(&ctx->work_ready, NULL);
+    pthread_cond_init(&ctx->job_done, NULL);
+
+    if ((ctx->trav = create_Traverser(num_threads)) == NULL
+            || (ctx->arena = arena_create(ARENA_CHUNK_SIZE)) == NULL
+            || (ctx->workers = calloc(num_threads, sizeof(Worker))) == NULL
+            || (ctx->threads = calloc(num_threads, sizeof(pthread_t))) == NULL) {
+        dwaf_context_destroy(ctx);
+        return NULL;
+    }
+    for (int i = 0; i < first_size; i++) {         //the others are set up when they are started
+        if (!set_up_worker(&ctx->workers[i], ctx, i)) {
+            dwaf_context_destroy(ctx);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < first_size; i++) {
+        if ((pthread_create(&ctx->threads[i], NULL, traverse_directories, (void*)&ctx->workers[i])) != 0) {
+            perror("pthread create");
+            break;                                  //the started threads steal the others' work
+        }
+        ctx->started_size++;
+    }
+    if (ctx->started_size == 0) {
+        dwaf_context_destroy(ctx);
+        return NULL;
+    }
+    ctx->trav->adaptive = first_size < num_threads;
+    ctx->trav->cpus = cpus;
+    atomic_store(&ctx->trav->started, ctx->started_size);
+    atomic_store(&ctx->trav->active, ctx->started_size);
+
+    return ctx;
+}
+
+
+void dwaf_context_destroy(Dwaf_context *ctx) {
+    if (ctx == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    ctx->quit = true;
+    pthread_cond_broadcast(&ctx->work_ready);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (int i = 0; i < ctx->started_size; i++) {
+        if (pthread_join(ctx->threads[i], NULL) != 0) {
+            perror("pthread_join");
+        }
+    }
+    if (ctx->workers != NULL) {
+        for (int i = 0; i < ctx->thread_size; i++) {
+            free_worker_buffers(&ctx->workers[i]);
+        }
+    }
+    if (ctx->trav != NULL) {
+        destroy_Traverser(ctx->trav);
+    }
+    if (ctx->arena != NULL) {
+        arena_destroy(ctx->arena);
+    }
+    free(ctx->workers);
+    free(ctx->threads);
+    pthread_cond_destroy(&ctx->work_ready);
+    pthread_cond_destroy(&ctx->job_done);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+
+//submits the traversal described by given function-and-argument, which is owned by the job
+static Dwaf_job *submit_traversal(Dwaf_context *ctx, Func_and_arg *func_and_arg, char **files, int files_size) {
+    Dwaf_job *job;
+
+    if (func_and_arg == NULL) {
+        return NULL;
+    }
+    if ((job = calloc(1, sizeof(Dwaf_job))) == NULL) {
+        destroy_Func_and_arg(func_and_arg);
+        return NULL;
+    }
+    if ((job->opts = create_Options(files_size, files, func_and_arg)) == NULL) {
+        free(job);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->current == NULL) {
+        start_job(ctx, job);
+    } else if (ctx->queue_tail == NULL) {
+        ctx->queue_head = ctx->queue_tail = job;
+    } else {
+        ctx->queue_tail->next = job;
+        ctx->queue_tail = job;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return job;
+}
+
+
+int dwaf_job_wait(Dwaf_context *ctx, Dwaf_job *job) {
+    int status;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (!job->done) {
+        pthread_cond_wait(&ctx->job_done, &ctx->lock);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    status = job->status;
+    destroy_Options(job->opts);
+    free(job);
+    return status;
+}
+
+
+//runs the traversal described by given function-and-argument, which is destroyed afterwards, with a context of its own
+static int run_traversal(Func_and_arg *func_and_arg, char **files, int files_size, int num_threads) {
+    int success_status = SUCCESS;
+    Dwaf_context *ctx;
+    Dwaf_job *job;
+
+    if (func_and_arg == NULL || (ctx = dwaf_context_create(num_threads)) == NULL) {
+        destroy_Func_and_arg(func_and_arg);
+        fprintf(stderr, "do-with-all-files: can not run\n");
+        return FAILURE;
+    }
+    if ((job = submit_traversal(ctx, func_and_arg, files, files_size)) == NULL) {
+        fprintf(stderr, "do-with-all-files: can not run\n");
+        success_status = FAILURE;
+    } else {
+        success_status = dwaf_job_wait(ctx, job);   //the traversing and doing
+    }
+    dwaf_context_destroy(ctx);
+    return success_status;
+}
+
+
+//sets the options of config shared by "do_with_all_entries" and "reduce_all_entries", returns false if out of memory
+static bool apply_config(Func_and_arg *func_and_arg, const Dwaf_config *config) {
+    if (config == NULL) {
+        return true;
+    }
+    func_and_arg->root_done = config->root_done;
+    func_and_arg->stats = config->stats;
+    func_and_arg->order = config->order;
+    func_and_arg->frontier_limit = config->frontier_limit > 0 ? (long)config->frontier_limit : DWAF_DEFAULT_FRONTIER_LIMIT;
+    if (config->trace_path != NULL && (func_and_arg->trace_path = strdup(config->trace_path)) == NULL) {
+        return false;
+    }
+    if ((func_and_arg->filter = config->filter) != NULL) {
+        func_and_arg->statx_mask |= filter_statx_mask(config->filter);
+    }
+    if ((func_and_arg->dedup_hardlinks = config->dedup_hardlinks != 0)) {
+        func_and_arg->statx_mask |= STATX_NLINK | STATX_INO;
+    }
+    if (config->cache_path != NULL) {
+        if (config->filter != NULL) {
+            fprintf(stderr, "do-with-all-files: cache '%s' is not used with a filter\n", config->cache_path);
+        } else if ((func_and_arg->statx_mask & ~DIR_CACHE_STATX_MASK) != 0) {
+            fprintf(stderr, "do-with-all-files: cache '%s' can not hold the wanted metadata, it is not used\n", config->cache_path);
+        } else if ((func_and_arg->cache_path = strdup(config->cache_path)) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//the function-and-argument of "do_with_all_entries", NULL if there is no function or no memory
+static Func_and_arg *entries_Func_and_arg(void (*do_with_entry)(Dwaf_entry *entry, void *arg), void *arg, 
+                                        const Dwaf_config *config) {
+    Func_and_arg *func_and_arg;
+
+    if (do_with_entry == NULL && (config == NULL || config->do_with_batch == NULL)) {
+        fprintf(stderr, "do-with-all-files: no function to do with files\n");
+        return NULL;
+    }
+    func_and_arg = create_Func_and_arg(NULL, do_with_entry, arg, config == NULL ? 0 : config->statx_mask);
+    if (func_and_arg != NULL && !apply_config(func_and_arg, config)) {
+        destroy_Func_and_arg(func_and_arg);
+        return NULL;
+    }
+    if (func_and_arg != NULL && config != NULL) {
+        func_and_arg->do_with_batch = config->do_with_batch;
+        func_and_arg->batch_size = config->batch_size > 0 ? config->batch_size : DWAF_DEFAULT_BATCH_SIZE;
+    }
+    return func_and_arg;
+}
+
+
+//the function-and-argument of "visit_all_entries", NULL if there is no function or no memory
+static Func_and_arg *visit_Func_and_arg(Dwaf_action (*visit)(Dwaf_entry *entry, void *arg), void *arg, 
+                                        const Dwaf_config *config) {
+    Func_and_arg *func_and_arg;
+
+    if (visit == NULL) {
+        fprintf(stderr, "do-with-all-files: no function to do with files\n");
+        return NULL;
+    }
+    func_and_arg = create_Func_and_arg(NULL, NULL, arg, config == NULL ? 0 : config->statx_mask);
+    if (func_and_arg != NULL && !apply_config(func_and_arg, config)) {
+        destroy_Func_and_arg(func_and_arg);
+        return NULL;
+    }
+    if (func_and_arg != NULL) {
+        func_and_arg->visit = visit;
+    }
+    return func_and_arg;
+}
+
+
+//the function-and-argument of "reduce_all_entries", NULL if there is no reducer or no memory
+static Func_and_arg *reduce_Func_and_arg(const Dwaf_reducer *reducer, void *arg, const Dwaf_config *config) {
+    Func_and_arg *func_and_arg;
+
+    if (reducer == NULL || reducer->accumulate == NULL) {
+        fprintf(stderr, "do-with-all-files: no function to do with files\n");
+        return NULL;
+    }
+    func_and_arg = create_Func_and_arg(NULL, NULL, arg, config == NULL ? 0 : config->statx_mask);
+    if (func_and_arg != NULL && !apply_config(func_and_arg, config)) {
+        destroy_Func_and_arg(func_and_arg);
+        return NULL;
+    }
+    if (func_and_arg != NULL) {
+        func_and_arg->reducer = *reducer;
+    }
+    return func_and_arg;
+}
+
+
+
+//------------------------------the function/interface--------------------------------//
+
+int do_with_all_files(void (*do_with_file)(char *file_path, void *arg), void *arg, char **files, 
+                        int files_size, int num_threads) {
+    
+    return run_traversal(create_Func_and_arg(do_with_file, NULL, arg, 0), files, files_size, num_threads);
+}
+
+
+int do_with_all_entries(void (*do_with_entry)(Dwaf_entry *entry, void *arg), void *arg, char **files, 
+                        int files_size, int num_threads, const Dwaf_config *config) {
+
+    return run_traversal(entries_Func_and_arg(do_with_entry, arg, config), files, files_size, num_threads);
+}
+
+
+int reduce_all_entries(const Dwaf_reducer *reducer, void *arg, char **files, 
+                        int files_size, int num_threads, const Dwaf_config *config) {
+
+    return run_traversal(reduce_Func_and_arg(reducer, arg, config), files, files_size, num_threads);
+}
+
+
+int visit_all_entries(Dwaf_action (*visit)(Dwaf_entry *entry, void *arg), void *arg, char **files, 
+                        int files_size, int num_threads, const Dwaf_config *config) {
+
+    return run_traversal(visit_Func_and_arg(visit, arg, config), files, files_size, num_threads);
+}
+
+
+Dwaf_job *dwaf_submit_files(Dwaf_context *ctx, void (*do_with_file)(char *file_path, void *arg), void *arg, 
+                        char **files, int files_size) {
+
+    return submit_traversal(ctx, create_Func_and_arg(do_with_file, NULL, arg, 0), files, files_size);
+}
+
+
+Dwaf_job *dwaf_submit_entries(Dwaf_context *ctx, void (*do_with_entry)(Dwaf_entry *entry, void *arg), void *arg, 
+                        char **files, int files_size, const Dwaf_config *config) {
+
+    return submit_traversal(ctx, entries_Func_and_arg(do_with_entry, arg, config), files, files_size);
+}
+
+
+Dwaf_job *dwaf_submit_visit(Dwaf_context *ctx, Dwaf_action (*visit)(Dwaf_entry *entry, void *arg), void *arg, 
+                        char **files, int files_size, const Dwaf_config *config) {
+
+    return submit_traversal(ctx, visit_Func_and_arg(visit, arg, config), files, files_size);
+}
+
+
+Dwaf_job *dwaf_submit_reduce(Dwaf_context *ctx, const Dwaf_reducer *reducer, void *arg, 
+                        char **files, int files_size, const Dwaf_config *config) {
+
+    return submit_traversal(ctx, reduce_Func_and_arg(reducer, arg, config), files, files_size);
+}
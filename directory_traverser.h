@@ -5,19 +5,266 @@
  * and calling a given function with given argument with each encountered file's
  * path as input. 
  * 
- * The interface consists only of the function "do_with_all_files" 
+ * The interface consists of the functions "do_with_all_files", "do_with_all_entries" and "reduce_all_entries",
+ * and of contexts that keep their threads between traversals (see "dwaf_context_create")
  */
 
 #ifndef DIR_TRAV_H
 #define DIR_TRAV_H
 
+#include <dirent.h>             //DT_* types of Dwaf_entry
+#include <stddef.h>
+#include <stdio.h>              //FILE of "dwaf_stats_print"
+#include <linux/stat.h>         //struct statx and STATX_* masks
+
 #define FAILURE 1
 #define SUCCESS 0
 
+#define DWAF_DEFAULT_BATCH_SIZE 256     //most entries per call of Dwaf_config's do_with_batch, if not set
+#define DWAF_DEFAULT_FRONTIER_LIMIT (64 * 1024 * 1024)     //bytes of queued directories DWAF_HYBRID switches at, if not set
+
 typedef struct Traverser Traverser;
 typedef struct Func_and_arg Func_and_arg;
 typedef struct Options Options;
+typedef struct Dwaf_context Dwaf_context;
+typedef struct Dwaf_job Dwaf_job;
+typedef struct Dwaf_watch Dwaf_watch;
+typedef struct Dwaf_filter Dwaf_filter;
+typedef struct Dwaf_stats Dwaf_stats;
+
+/**
+ * One encountered file, as given to the function of "do_with_all_entries".
+ * Only valid during the call.
+ */
+typedef struct Dwaf_entry {
+    const char *path;           //path of file, starting with one of the given files
+    int name_offset;            //path + name_offset is the file's name
+    int parent_fd;              //open parent directory to use name with in *at-calls, AT_FDCWD for the given files (name is then path)
+    int depth;                  //0 for the given files, 1 for their sub-files and so on
+    int root_index;             //index of the given file the file is under
+    unsigned char d_type;       //DT_* type of file, DT_UNKNOWN if not known
+    unsigned int stx_mask;      //STATX_* fields of stx that were fetched, 0 if file was not stat:ed
+    struct statx stx;
+} Dwaf_entry;
+
+/**
+ * Orders the directories are read in. Either way all threads are kept busy, since idle 
+ * threads steal the oldest directories queued by the others. Depth-first keeps the queued 
+ * directories near depth times fan-out per thread; breadth-first queues whole levels of 
+ * the tree, which on wide trees can be millions of paths, but reads each level before the next.
+ */
+typedef enum Dwaf_order { 
+    DWAF_DEPTH_FIRST,           //each thread reads the directory it queued last, the default
+    DWAF_BREADTH_FIRST,         //each thread reads the directory it queued first
+    DWAF_HYBRID                 //breadth-first while the queued directories take less than frontier_limit bytes, 
+                                //depth-first above it
+} Dwaf_order;
+
+/**
+ * Options for "do_with_all_entries", "visit_all_entries" and "reduce_all_entries", NULL or 
+ * zeroed for the defaults. Only "do_with_all_entries" uses do_with_batch and batch_size.
+ */
+typedef struct Dwaf_config {
+    unsigned int statx_mask;    //STATX_* fields to fetch for each file, 0 to stat only when the type is unknown
+    void (*root_done)(const char *root_path, int root_index, int status, void *arg);   
+                                //if set, called once for each given file when it and all its sub-files are done,
+                                //with SUCCESS or FAILURE, and the argument of "do_with_all_entries"
+    void (*do_with_batch)(Dwaf_entry *entries, int entries_size, void *arg);
+                                //if set, called instead of the function of "do_with_all_entries" (which may then be NULL),
+                                //with up to batch_size entries that are all in the same directory (or one given file)
+    int batch_size;             //most entries per call of do_with_batch, 0 for DWAF_DEFAULT_BATCH_SIZE
+    const char *cache_path;     //if set, directories whose times did not change since the cache file was written
+                                //are not read, their cached entries are given instead, and the file is rewritten
+                                //after the traversal (files changed in place keep their cached metadata)
+    const Dwaf_filter *filter;  //if set, files it leaves out are not given, and directories it leaves out are not read
+                                //(no cache is used with a filter, since the cache would then miss the files left out)
+    int dedup_hardlinks;        //if not 0, a file with several hard links is only given for the first of its links met
+                                //(in any of the given files), so it is counted once as by du; directories are always given
+    Dwaf_stats *stats;          //if set, the threads count what they do and time it, and stats is filled in when done
+    Dwaf_order order;           //order directories are read in
+    size_t frontier_limit;      //for DWAF_HYBRID, 0 for DWAF_DEFAULT_FRONTIER_LIMIT
+    const char *trace_path;     //if set, each thread records when it opened, read and stat:ed, called the function,
+                                //queued, stole and looked for work, and the events are written to this file when done
+                                //as Chrome trace-event JSON (for chrome://tracing or Perfetto)
+} Dwaf_config;
+
+/**
+ * Operations timed when a traversal collects stats. DWAF_OP_URING is one wait for a 
+ * batch of statx calls or directory opens submitted through io_uring, which are then
+ * not timed one by one. DWAF_OP_CALLBACK is one call of the user's function.
+ */
+typedef enum Dwaf_op { 
+    DWAF_OP_OPEN, DWAF_OP_GETDENTS, DWAF_OP_STATX, DWAF_OP_URING, DWAF_OP_CALLBACK, DWAF_OPS_SIZE 
+} Dwaf_op;
+
+#define DWAF_HISTOGRAM_SIZE 32      //buckets of a latency histogram, bucket i counts times in [2^i, 2^(i+1)) ns
+
+/**
+ * What one thread did in a traversal, or the sum of all threads. Times are in nanoseconds.
+ */
+typedef struct Dwaf_thread_stats {
+    unsigned long long dirs;            //directories read (or replayed from the cache)
+    unsigned long long files;           //entries met, including the ones left out by a filter or as extra links
+    unsigned long long syscalls;        //opens, getdents64 and statx calls, and io_uring waits (with each operation submitted)
+    unsigned long long path_bytes;      //bytes of paths copied for queued directories and entry batches
+    unsigned long long idle_ns;         //time looking for work
+    unsigned long long lock_ns;         //time blocked on the locks of the threads' work queues
+    unsigned long long op_count[DWAF_OPS_SIZE];
+    unsigned long long op_ns[DWAF_OPS_SIZE];
+    unsigned long long histogram[DWAF_OPS_SIZE][DWAF_HISTOGRAM_SIZE];  //the last bucket also counts longer times
+} Dwaf_thread_stats;
+
+/**
+ * Stats of a traversal, filled in when it is done if given in its Dwaf_config. 
+ * threads is allocated for each traversal; free it with "dwaf_stats_free" before 
+ * the struct is used again. "dwaf_stats_print" prints the totals, each thread's
+ * time split, and the percentiles of each operation's latency to out.
+ */
+struct Dwaf_stats {
+    unsigned long long wall_ns;         //from the start of the traversal until the last thread was done
+    int threads_size;
+    Dwaf_thread_stats *threads;
+    Dwaf_thread_stats total;
+};
+
+void dwaf_stats_print(const Dwaf_stats *stats, FILE *out);
+
+void dwaf_stats_free(Dwaf_stats *stats);
+
+/**
+ * Rules of files to leave out of a traversal, set once and then shared by any
+ * number of traversals (it must not be changed or destroyed while they run).
+ * The given files are never left out.
+ *
+ * "dwaf_filter_exclude" leaves out files of any type whose name matches pattern 
+ * (a glob as in fnmatch, or a plain name), directories with everything under them.
+ * "dwaf_filter_include" keeps, of the files that are not directories, only those 
+ * whose name matches one of the included patterns; directories are still read.
+ * "dwaf_filter_max_depth" leaves out files deeper than max_depth.
+ * "dwaf_filter_size" and "dwaf_filter_mtime" keep, of the files that are not 
+ * directories, only those whose size in bytes or modification time in seconds since 
+ * the epoch is within [min, max]. These two need each file stat:ed, so the fields
+ * are added to the statx_mask of the traversal.
+ * Rules on names and depth are checked before the file's path is built or it is stat:ed.
+ */
+Dwaf_filter *dwaf_filter_create(void);
+
+void dwaf_filter_destroy(Dwaf_filter *f);
+
+int dwaf_filter_exclude(Dwaf_filter *f, const char *pattern);
+
+int dwaf_filter_include(Dwaf_filter *f, const char *pattern);
+
+void dwaf_filter_max_depth(Dwaf_filter *f, int max_depth);
+
+void dwaf_filter_size(Dwaf_filter *f, long long min_size, long long max_size);
+
+void dwaf_filter_mtime(Dwaf_filter *f, long long min_mtime, long long max_mtime);
+
+/**
+ * Functions of "reduce_all_entries". Each thread gets its own state of state_size 
+ * bytes (zeroed, then given to init), accumulates the files it encounters into it, 
+ * and the states are merged once the traversal is done. No two calls are made with
+ * the same state at the same time, and the merges are made one at a time, so none of 
+ * the functions need locks. init and merge may be NULL.
+ */
+typedef struct Dwaf_reducer {
+    size_t state_size;
+    void (*init)(void *state, void *arg);
+    void (*accumulate)(void *state, Dwaf_entry *entry, void *arg);
+    void (*merge)(void *state, void *arg);      //merges a thread's state into the argument of "reduce_all_entries"
+} Dwaf_reducer;
+
+/**
+ * num_threads given as DWAF_ADAPTIVE_THREADS starts one thread per CPU, and lets 
+ * the traversal tune how many threads work as it goes: threads are parked while 
+ * they mostly find no work, and more are started (up to several per CPU) while 
+ * the threads mostly wait for I/O, the CPUs are not busy, and directories queue 
+ * up, as on network file systems and disks that serve many requests at once.
+ */
+#define DWAF_ADAPTIVE_THREADS 0
 
 int do_with_all_files(void (*do_with_file)(char *file_path, void *arg), void *arg, char **files, int directories_size, int num_threads);
 
+int do_with_all_entries(void (*do_with_entry)(Dwaf_entry *entry, void *arg), void *arg, char **files, 
+                        int files_size, int num_threads, const Dwaf_config *config);
+
+/**
+ * What the function of "visit_all_entries" returns to steer the traversal. 
+ * DWAF_SKIP_SUBTREE for a directory leaves its files out (for other files it 
+ * is the same as DWAF_CONTINUE). DWAF_ABORT stops the whole traversal: no more 
+ * files are given once the threads see it (calls already under way still finish), 
+ * queued directories are dropped unread, and the traversal returns as soon as 
+ * the threads are done with the directories they are reading. An aborted 
+ * traversal is not an error; its success-status only tells of errors met before.
+ */
+typedef enum Dwaf_action { DWAF_CONTINUE, DWAF_SKIP_SUBTREE, DWAF_ABORT } Dwaf_action;
+
+int visit_all_entries(Dwaf_action (*visit)(Dwaf_entry *entry, void *arg), void *arg, char **files, 
+                        int files_size, int num_threads, const Dwaf_config *config);
+
+int reduce_all_entries(const Dwaf_reducer *reducer, void *arg, char **files, 
+                        int files_size, int num_threads, const Dwaf_config *config);
+
+/**
+ * A context keeps num_threads threads and their buffers between traversals, so 
+ * traversals submitted to it do not pay for creating and joining threads. The 
+ * traversals are done one at a time, in the order they were submitted, each with 
+ * all the threads. The functions below work like the ones above, but return a job
+ * at once (NULL on failure). The given files must stay valid until the job is done.
+ * 
+ * "dwaf_job_wait" waits until job is done, frees it and returns its success-status; 
+ * every job must be waited for once, also before the context is destroyed. The 
+ * functions given with a job must not wait for jobs of the same context.
+ * "dwaf_context_destroy" lets the threads finish the submitted jobs before they quit.
+ * An adaptive context keeps the number of working threads a job ends with for the next.
+ */
+Dwaf_context *dwaf_context_create(int num_threads);
+
+void dwaf_context_destroy(Dwaf_context *ctx);
+
+Dwaf_job *dwaf_submit_files(Dwaf_context *ctx, void (*do_with_file)(char *file_path, void *arg), void *arg, 
+                        char **files, int files_size);
+
+Dwaf_job *dwaf_submit_entries(Dwaf_context *ctx, void (*do_with_entry)(Dwaf_entry *entry, void *arg), void *arg, 
+                        char **files, int files_size, const Dwaf_config *config);
+
+Dwaf_job *dwaf_submit_visit(Dwaf_context *ctx, Dwaf_action (*visit)(Dwaf_entry *entry, void *arg), void *arg, 
+                        char **files, int files_size, const Dwaf_config *config);
+
+Dwaf_job *dwaf_submit_reduce(Dwaf_context *ctx, const Dwaf_reducer *reducer, void *arg, 
+                        char **files, int files_size, const Dwaf_config *config);
+
+int dwaf_job_wait(Dwaf_context *ctx, Dwaf_job *job);
+
+/**
+ * A watch traverses the given files once, then keeps them current: each
+ * "dwaf_watch_poll" waits up to timeout_ms (-1 for ever) for changes, and calls
+ * do_with_change once for each entry created, modified or deleted since, in the
+ * calling thread. Directories created or moved in are traversed, and all their
+ * entries told as created. During the first traversal every entry is told with
+ * DWAF_FOUND, from several threads at once, as with "do_with_all_entries".
+ *
+ * Deleted entries have no metadata (stx_mask is 0) and are told by path; a
+ * directory moved out of the given files is told as one deleted entry. Only
+ * directories are watched, so given files that are not directories are told once.
+ * Entries of changes have parent_fd AT_FDCWD and name_offset 0.
+ * An entry created in a new directory while it is traversed may be told created twice.
+ *
+ * "dwaf_watch_poll" returns FAILURE if changes were lost or a directory could not
+ * be watched (see fs.inotify.max_user_watches); the watch should then be recreated.
+ * "dwaf_watch_fd" returns a descriptor that is readable when changes are waiting,
+ * for use with poll/select.
+ */
+enum Dwaf_change { DWAF_FOUND, DWAF_CREATED, DWAF_MODIFIED, DWAF_DELETED };
+
+Dwaf_watch *dwaf_watch_create(void (*do_with_change)(Dwaf_entry *entry, int change, void *arg), void *arg,
+                        char **files, int files_size, int num_threads, const Dwaf_config *config);
+
+int dwaf_watch_poll(Dwaf_watch *w, int timeout_ms);
+
+int dwaf_watch_fd(Dwaf_watch *w);
+
+void dwaf_watch_destroy(Dwaf_watch *w);
+
 #endif
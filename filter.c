@@ -0,0 +1,292 @@
+#define _GNU_SOURCE                 //for statx fields
+#include "filter.h"
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define GLOB_CHARS "*?[\\"
+
+
+//patterns of one kind, with their lengths
+typedef struct Pattern_list {
+    char **patterns;
+    size_t *lens;
+    int size;
+    int capacity;
+} Pattern_list;
+
+//name patterns sorted by how they are matched
+typedef struct Name_set {
+    char **names;                   //open-addressed hash set of plain names, NULL for empty slots
+    size_t names_capacity;          //power of 2
+    size_t names_size;
+    Pattern_list suffixes;          //patterns "*suffix"
+    Pattern_list prefixes;          //patterns "prefix*"
+    Pattern_list globs;             //any other pattern, matched with fnmatch
+} Name_set;
+
+struct Dwaf_filter {
+    Name_set exclude;               //entries of any type left out
+    Name_set include;               //if not empty, only files that are not directories matching it are kept
+    int max_depth;                  //-1 for no limit
+    bool has_size;
+    long long min_size, max_size;
+    bool has_mtime;
+    long long min_mtime, max_mtime;
+};
+
+
+static uint64_t hash_name(const char *name)
+{
+    uint64_t hash = 14695981039346656037ULL;        //FNV-1a
+
+    while (*name != '\0') {
+        hash ^= (unsigned char)*name++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+//finds the slot of name in the hash set, empty if name is not in it
+static size_t find_slot(char **names, size_t capacity, const char *name)
+{
+    size_t slot = hash_name(name) & (capacity - 1);
+
+    while (names[slot] != NULL && strcmp(names[slot], name) != 0) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+
+static bool add_name(Name_set *set, const char *name)
+{
+    size_t slot;
+
+    if ((set->names_size + 1) * 2 > set->names_capacity) {       //kept at most half full
+        size_t new_capacity = set->names_capacity == 0 ? 16 : set->names_capacity * 2;
+        char **grown;
+        if ((grown = calloc(new_capacity, sizeof(char*))) == NULL) {
+            return false;
+        }
+        for (size_t i = 0; i < set->names_capacity; i++) {
+            if (set->names[i] != NULL) {
+                grown[find_slot(grown, new_capacity, set->names[i])] = set->names[i];
+            }
+        }
+        free(set->names);
+        set->names = grown;
+        set->names_capacity = new_capacity;
+    }
+    slot = find_slot(set->names, set->names_capacity, name);
+    if (set->names[slot] != NULL) {
+        return true;
+    }
+    if ((set->names[slot] = strdup(name)) == NULL) {
+        return false;
+    }
+    set->names_size++;
+    return true;
+}
+
+
+static bool add_pattern(Pattern_list *list, const char *pattern, size_t len)
+{
+    if (list->size == list->capacity) {
+        int new_capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+        char **patterns;
+        size_t *lens;
+        if ((patterns = realloc(list->patterns, new_capacity * sizeof(char*))) == NULL) {
+            return false;
+        }
+        list->patterns = patterns;
+        if ((lens = realloc(list->lens, new_capacity * sizeof(size_t))) == NULL) {
+            return false;
+        }
+        list->lens = lens;
+        list->capacity = new_capacity;
+    }
+    if ((list->patterns[list->size] = strndup(pattern, len)) == NULL) {
+        return false;
+    }
+    list->lens[list->size++] = len;
+    return true;
+}
+
+
+//sorts pattern into the cheapest way it can be matched
+static bool add_to_set(Name_set *set, const char *pattern)
+{
+    size_t len = strlen(pattern);
+
+    if (strpbrk(pattern, GLOB_CHARS) == NULL) {
+        return add_name(set, pattern);
+    }
+    if (pattern[0] == '*' && strpbrk(pattern + 1, GLOB_CHARS) == NULL) {
+        return add_pattern(&set->suffixes, pattern + 1, len - 1);
+    }
+    if (len > 0 && pattern[len - 1] == '*' && strcspn(pattern, GLOB_CHARS) == len - 1) {
+        return add_pattern(&set->prefixes, pattern, len - 1);
+    }
+    return add_pattern(&set->globs, pattern, len);
+}
+
+
+static bool is_empty(const Name_set *set)
+{
+    return set->names_size == 0 && set->suffixes.size == 0 && set->prefixes.size == 0 && set->globs.size == 0;
+}
+
+
+static bool set_matches(const Name_set *set, const char *name)
+{
+    size_t len;
+
+    if (set->names_size > 0 && set->names[find_slot(set->names, set->names_capacity, name)] != NULL) {
+        return true;
+    }
+    len = strlen(name);
+    for (int i = 0; i < set->suffixes.size; i++) {
+        size_t suffix_len = set->suffixes.lens[i];
+        if (len >= suffix_len && memcmp(name + len - suffix_len, set->suffixes.patterns[i], suffix_len) == 0) {
+            return true;
+        }
+    }
+    for (int i = 0; i < set->prefixes.size; i++) {
+        if (len >= set->prefixes.lens[i] && memcmp(name, set->prefixes.patterns[i], set->prefixes.lens[i]) == 0) {
+            return true;
+        }
+    }
+    for (int i = 0; i < set->globs.size; i++) {
+        if (fnmatch(set->globs.patterns[i], name, 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void free_patterns(Pattern_list *list)
+{
+    for (int i = 0; i < list->size; i++) {
+        free(list->patterns[i]);
+    }
+    free(list->patterns);
+    free(list->lens);
+}
+
+
+static void free_set(Name_set *set)
+{
+    for (size_t i = 0; i < set->names_capacity; i++) {
+        free(set->names[i]);
+    }
+    free(set->names);
+    free_patterns(&set->suffixes);
+    free_patterns(&set->prefixes);
+    free_patterns(&set->globs);
+}
+
+
+bool filter_skips_name(const Dwaf_filter *f, const char *name, unsigned char d_type, int depth)
+{
+    if (f->max_depth >= 0 && depth > f->max_depth) {
+        return true;
+    }
+    if (set_matches(&f->exclude, name)) {
+        return true;
+    }
+    return d_type != DT_DIR && d_type != DT_UNKNOWN && !is_empty(&f->include) && !set_matches(&f->include, name);
+}
+
+
+bool filter_skips_entry(const Dwaf_filter *f, const char *name, const Dwaf_entry *entry)
+{
+    if (entry->d_type == DT_DIR) {
+        return false;
+    }
+    if (!is_empty(&f->include) && !set_matches(&f->include, name)) {
+        return true;
+    }
+    if (f->has_size && (!(entry->stx_mask & STATX_SIZE)
+            || (long long)entry->stx.stx_size < f->min_size || (long long)entry->stx.stx_size > f->max_size)) {
+        return true;
+    }
+    if (f->has_mtime && (!(entry->stx_mask & STATX_MTIME)
+            || entry->stx.stx_mtime.tv_sec < f->min_mtime || entry->stx.stx_mtime.tv_sec > f->max_mtime)) {
+        return true;
+    }
+    return false;
+}
+
+
+bool filter_prunes(const Dwaf_filter *f, int depth)
+{
+    return f->max_depth >= 0 && depth >= f->max_depth;
+}
+
+
+unsigned int filter_statx_mask(const Dwaf_filter *f)
+{
+    return (f->has_size ? STATX_SIZE : 0) | (f->has_mtime ? STATX_MTIME : 0);
+}
+
+
+Dwaf_filter *dwaf_filter_create(void)
+{
+    Dwaf_filter *f;
+
+    if ((f = calloc(1, sizeof(Dwaf_filter))) == NULL) {
+        return NULL;
+    }
+    f->max_depth = -1;
+    return f;
+}
+
+
+void dwaf_filter_destroy(Dwaf_filter *f)
+{
+    if (f == NULL) {
+        return;
+    }
+    free_set(&f->exclude);
+    free_set(&f->include);
+    free(f);
+}
+
+
+int dwaf_filter_exclude(Dwaf_filter *f, const char *pattern)
+{
+    return add_to_set(&f->exclude, pattern) ? SUCCESS : FAILURE;
+}
+
+
+int dwaf_filter_include(Dwaf_filter *f, const char *pattern)
+{
+    return add_to_set(&f->include, pattern) ? SUCCESS : FAILURE;
+}
+
+
+void dwaf_filter_max_depth(Dwaf_filter *f, int max_depth)
+{
+    f->max_depth = max_depth;
+}
+
+
+void dwaf_filter_size(Dwaf_filter *f, long long min_size, long long max_size)
+{
+    f->has_size = true;
+    f->min_size = min_size;
+    f->max_size = max_size;
+}
+
+
+void dwaf_filter_mtime(Dwaf_filter *f, long long min_mtime, long long max_mtime)
+{
+    f->has_mtime = true;
+    f->min_mtime = min_mtime;
+    f->max_mtime = max_mtime;
+}
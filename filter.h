@@ -0,0 +1,71 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+/**
+ * @defgroup filter_h Filter
+ *
+ * @brief This module is used to leave files out of a traversal as early
+ * as possible, by rules given once and compiled into a matcher.
+ *
+ * Name patterns are sorted by kind when added: plain names go into a
+ * hash set, patterns like "*.o" and "tmp*" into lists of suffixes and
+ * prefixes, and only other patterns are matched with fnmatch. Rules
+ * on names and depth are checked on the name as read, before the path
+ * of the entry is built or the entry is stat:ed, so an excluded
+ * directory costs nothing more. Size and modification time rules need
+ * the entry stat:ed, and are checked after.
+ *
+ * A filter is not changed while traversals use it, so any number of
+ * threads may use it at once.
+ *
+ * The rules are set with the "dwaf_filter_*" functions of directory_traverser.h.
+ *
+ */
+
+#include "directory_traverser.h"
+#include <stdbool.h>
+
+
+/**
+ * @brief Tells if an entry known only by name and readdir type is left out. Entries
+ *        of unknown type (DT_UNKNOWN) are only left out by the rules for all types.
+ *
+ * @param f          filter.
+ * @param name       name of entry.
+ * @param d_type     DT_* type of entry as read.
+ * @param depth      depth of entry, 1 for the entries of a given directory.
+ * @return           true if the entry is left out, and its subtree with it.
+ */
+bool filter_skips_name(const Dwaf_filter *f, const char *name, unsigned char d_type, int depth);
+
+
+/**
+ * @brief Tells if a stat:ed entry is left out by the rules for files that are not directories.
+ *
+ * @param f          filter.
+ * @param name       name of entry.
+ * @param entry      entry with its type and the fields of filter_statx_mask filled in.
+ * @return           true if the entry is left out.
+ */
+bool filter_skips_entry(const Dwaf_filter *f, const char *name, const Dwaf_entry *entry);
+
+
+/**
+ * @brief Tells if the entries of a directory at depth are all left out.
+ *
+ * @param f          filter.
+ * @param depth      depth of directory, 0 for the given files.
+ * @return           true if the directory is not read.
+ */
+bool filter_prunes(const Dwaf_filter *f, int depth);
+
+
+/**
+ * @brief Returns the STATX_* fields the filter's rules need of each entry.
+ *
+ * @param f          filter.
+ * @return           STATX_* mask, 0 if no rule needs an entry stat:ed.
+ */
+unsigned int filter_statx_mask(const Dwaf_filter *f);
+
+#endif /* FILTER_H */
@@ -0,0 +1,161 @@
+#include "inode_set.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHARD_BITS 6
+#define SHARDS_SIZE (1 << SHARD_BITS)
+#define SHARD_MIN_CAPACITY 64
+#define CACHE_LINE_SIZE 64
+
+
+//one file in the set, the slot is empty while links_left is 0
+typedef struct inode_slot {
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t links_left;            //links not yet met
+} Inode_slot;
+
+//one part of the set, with its own lock, alone on its cache lines
+typedef struct inode_shard {
+    pthread_mutex_t lock;
+    Inode_slot *slots;
+    size_t capacity;                //power of 2
+    size_t size;
+} __attribute__((aligned(CACHE_LINE_SIZE))) Inode_shard;
+
+struct inode_set {
+    Inode_shard shards[SHARDS_SIZE];
+};
+
+
+static uint64_t hash_inode(uint64_t dev, uint64_t ino)
+{
+    uint64_t hash = ino ^ (dev * 0x9e3779b97f4a7c15ULL);      //mixed as in splitmix64
+
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+
+//the shard is picked with the high bits of the hash, the slot in it with the low bits
+static size_t home_slot(const Inode_shard *shard, uint64_t dev, uint64_t ino)
+{
+    return hash_inode(dev, ino) & (shard->capacity - 1);
+}
+
+
+static bool grow_shard(Inode_shard *shard)
+{
+    size_t new_capacity = shard->capacity == 0 ? SHARD_MIN_CAPACITY : shard->capacity * 2;
+    Inode_slot *old_slots = shard->slots;
+    size_t old_capacity = shard->capacity;
+    Inode_slot *slots;
+
+    if ((slots = calloc(new_capacity, sizeof(Inode_slot))) == NULL) {
+        return false;
+    }
+    shard->slots = slots;
+    shard->capacity = new_capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].links_left > 0) {
+            size_t slot = home_slot(shard, old_slots[i].dev, old_slots[i].ino);
+            while (slots[slot].links_left > 0) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            slots[slot] = old_slots[i];
+        }
+    }
+    free(old_slots);
+    return true;
+}
+
+
+//empties slot, moving back the files after it that would otherwise no longer be found
+static void remove_slot(Inode_shard *shard, size_t slot)
+{
+    size_t mask = shard->capacity - 1, next = slot;
+
+    for (;;) {
+        size_t home;
+        next = (next + 1) & mask;
+        if (shard->slots[next].links_left == 0) {
+            break;
+        }
+        home = home_slot(shard, shard->slots[next].dev, shard->slots[next].ino);
+        //the file at next may move to slot if its home is not between slot and next
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            shard->slots[slot] = shard->slots[next];
+            slot = next;
+        }
+    }
+    shard->slots[slot].links_left = 0;
+    shard->size--;
+}
+
+
+Inode_set *inode_set_create(void)
+{
+    Inode_set *set;
+
+    if ((set = aligned_alloc(CACHE_LINE_SIZE, sizeof(Inode_set))) == NULL) {
+        return NULL;
+    }
+    memset(set, 0, sizeof(Inode_set));
+    for (int i = 0; i < SHARDS_SIZE; i++) {
+        if (pthread_mutex_init(&set->shards[i].lock, NULL) != 0) {
+            while (--i >= 0) {
+                pthread_mutex_destroy(&set->shards[i].lock);
+            }
+            free(set);
+            return NULL;
+        }
+    }
+    return set;
+}
+
+
+void inode_set_destroy(Inode_set *set)
+{
+    for (int i = 0; i < SHARDS_SIZE; i++) {
+        pthread_mutex_destroy(&set->shards[i].lock);
+        free(set->shards[i].slots);
+    }
+    free(set);
+}
+
+
+bool inode_set_first_link(Inode_set *set, uint64_t dev, uint64_t ino, uint32_t nlink)
+{
+    Inode_shard *shard = &set->shards[hash_inode(dev, ino) >> (64 - SHARD_BITS)];
+    bool first = true;
+    size_t slot;
+
+    if (nlink <= 1) {
+        return true;
+    }
+    pthread_mutex_lock(&shard->lock);
+    if ((shard->size + 1) * 2 > shard->capacity && !grow_shard(shard)) {       //kept at most half full
+        pthread_mutex_unlock(&shard->lock);
+        return true;
+    }
+    slot = home_slot(shard, dev, ino);
+    while (shard->slots[slot].links_left > 0 && (shard->slots[slot].dev != dev || shard->slots[slot].ino != ino)) {
+        slot = (slot + 1) & (shard->capacity - 1);
+    }
+    if (shard->slots[slot].links_left > 0) {
+        first = false;
+        if (--shard->slots[slot].links_left == 0) {     //last link met, the file will not be met again
+            remove_slot(shard, slot);
+        }
+    } else {
+        shard->slots[slot].dev = dev;
+        shard->slots[slot].ino = ino;
+        shard->slots[slot].links_left = nlink - 1;
+        shard->size++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return first;
+}
@@ -0,0 +1,59 @@
+#ifndef INODE_SET_H
+#define INODE_SET_H
+
+/**
+ * @defgroup inode_set_h Inode set
+ *
+ * @brief This module is used to tell, from many threads at once, which
+ * link of a file with several hard links is met first, so the file
+ * can be counted once.
+ *
+ * The set is split into shards by the hash of device and inode, each
+ * an open-addressed hash table with its own lock, so threads seldom
+ * wait for each other. Only files with more than one link are added,
+ * and each remembers how many of its links are yet to be met. When
+ * the last one is met the file is removed, so the set only holds files
+ * whose links are partly traversed: a tree whose links are all inside
+ * it ends with an empty set, however many files it has.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/**
+ * The type for the set.
+*/
+typedef struct inode_set Inode_set;
+
+
+/**
+ * @brief Create and return an empty set.
+ *
+ * @return           Inode_set pointer to the created set, NULL on failure.
+ */
+Inode_set *inode_set_create(void);
+
+
+/**
+ * @brief Destroys set.
+ *
+ * @param set        Inode_set pointer to set to be destroyed.
+ */
+void inode_set_destroy(Inode_set *set);
+
+
+/**
+ * @brief Tells if a link of a file is the first one met. Thread-safe.
+ *
+ * @param set        Inode_set pointer to set.
+ * @param dev        device of file.
+ * @param ino        inode of file.
+ * @param nlink      number of links of file.
+ * @return           true if no other link of the file was met before, or if
+ *                   the set is out of memory (the file is then counted again).
+ */
+bool inode_set_first_link(Inode_set *set, uint64_t dev, uint64_t ino, uint32_t nlink);
+
+#endif /* INODE_SET_H */
@@ -0,0 +1,411 @@
+#define _GNU_SOURCE                 //for mkostemp
+#include "snapshot.h"
+#include "arena.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "DWAFSN1"
+
+
+//start of the snapshot file, followed by entries_size Snapshot_entry, entries_size + 1
+//summed block counts, and names_size bytes of paths
+typedef struct snapshot_header {
+    char magic[8];
+    uint64_t entries_size;
+    uint64_t names_size;
+} Snapshot_header;
+
+//one entry as stored in the snapshot file
+typedef struct snapshot_entry {
+    uint64_t subtree_end;       //index after the last entry under this one
+    uint64_t path_offset;       //offset of path in the paths
+    uint32_t depth;
+    uint8_t d_type;
+    uint8_t pad[3];
+} Snapshot_entry;
+
+struct snapshot {
+    void *map;
+    size_t size;
+    uint64_t entries_size;
+    const Snapshot_entry *entries;
+    const uint64_t *blocks_before;      //blocks_before[i] is the summed block count of the entries before i
+    const char *names;
+    uint64_t names_size;
+};
+
+//one entry while it is written
+typedef struct snapshot_record {
+    const char *path;
+    uint64_t blocks;
+    uint64_t subtree_end;
+    uint32_t depth;
+    uint8_t d_type;
+} Snapshot_record;
+
+struct snapshot_part {
+    Snapshot_part *next;
+    Arena *paths;
+    Snapshot_record *records;
+    size_t records_size;
+    size_t records_capacity;
+    bool failed;
+};
+
+struct snapshot_writer {
+    char *path;
+    pthread_mutex_t lock;       //guards parts
+    Snapshot_part *parts;
+};
+
+
+//orders paths in pre-order: as strcmp, but '/' before any other character
+static int compare_paths(const char *a, const char *b)
+{
+    const unsigned char *x = (const unsigned char*)a, *y = (const unsigned char*)b;
+
+    while (*x != '\0' && *x == *y) {
+        x++;
+        y++;
+    }
+    if (*x == *y) {
+        return 0;
+    }
+    if (*x == '\0' || *y == '\0') {
+        return *x == '\0' ? -1 : 1;
+    }
+    if (*x == '/' || *y == '/') {
+        return *x == '/' ? -1 : 1;
+    }
+    return *x < *y ? -1 : 1;
+}
+
+
+static int compare_records(const void *a, const void *b)
+{
+    return compare_paths(((const Snapshot_record*)a)->path, ((const Snapshot_record*)b)->path);
+}
+
+
+//tells if path is under the directory at dir_path
+static bool is_under(const char *path, const char *dir_path)
+{
+    size_t len = strlen(dir_path);
+
+    return strncmp(path, dir_path, len) == 0 && path[len] != '\0'
+            && (path[len] == '/' || (len > 0 && dir_path[len - 1] == '/'));
+}
+
+
+Snapshot *snapshot_open(const char *path)
+{
+    Snapshot *snap;
+    const Snapshot_header *header;
+    struct stat st;
+    size_t fixed_size;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Snapshot_header) || (snap = calloc(1, sizeof(Snapshot))) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    snap->size = (size_t)st.st_size;
+    snap->map = mmap(NULL, snap->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snap->map == MAP_FAILED) {
+        free(snap);
+        return NULL;
+    }
+
+    header = snap->map;
+    fixed_size = sizeof(Snapshot_header) + sizeof(uint64_t);
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+            || header->entries_size > (snap->size - fixed_size) / (sizeof(Snapshot_entry) + sizeof(uint64_t))
+            || header->names_size != snap->size - fixed_size - header->entries_size * (sizeof(Snapshot_entry) + sizeof(uint64_t))
+            || (header->names_size > 0 && ((const char*)snap->map)[snap->size - 1] != '\0')) {
+        snapshot_close(snap);
+        return NULL;
+    }
+    snap->entries_size = header->entries_size;
+    snap->names_size = header->names_size;
+    snap->entries = (const Snapshot_entry*)(header + 1);
+    snap->blocks_before = (const uint64_t*)(snap->entries + snap->entries_size);
+    snap->names = (const char*)(snap->blocks_before + snap->entries_size + 1);
+    madvise(snap->map, snap->size, MADV_RANDOM);
+
+    return snap;
+}
+
+
+void snapshot_close(Snapshot *snap)
+{
+    munmap(snap->map, snap->size);
+    free(snap);
+}
+
+
+long snapshot_find(Snapshot *snap, const char *path)
+{
+    size_t len = strlen(path);
+    char *key;
+    long low = 0, high = (long)snap->entries_size - 1, found = -1;
+
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    if ((key = strndup(path, len)) == NULL) {
+        return -1;
+    }
+    while (low <= high) {
+        long middle = low + (high - low) / 2;
+        uint64_t offset = snap->entries[middle].path_offset;
+        int order;
+
+        if (offset >= snap->names_size) {
+            break;                          //not a valid snapshot
+        }
+        order = compare_paths(snap->names + offset, key);
+        if (order == 0) {
+            found = middle;
+            break;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    free(key);
+    return found;
+}
+
+
+//end of entry's subtree, kept within the snapshot
+static uint64_t subtree_end(Snapshot *snap, long index)
+{
+    uint64_t end = snap->entries[index].subtree_end;
+
+    return end > (uint64_t)index && end <= snap->entries_size ? end : (uint64_t)index + 1;
+}
+
+
+uint64_t snapshot_subtree_blocks(Snapshot *snap, long index)
+{
+    return snap->blocks_before[subtree_end(snap, index)] - snap->blocks_before[index];
+}
+
+
+uint64_t snapshot_subtree_size(Snapshot *snap, long index)
+{
+    return subtree_end(snap, index) - (uint64_t)index;
+}
+
+
+Snapshot_writer *snapshot_writer_create(const char *path)
+{
+    Snapshot_writer *w;
+
+    if ((w = calloc(1, sizeof(Snapshot_writer))) == NULL) {
+        return NULL;
+    }
+    if ((w->path = strdup(path)) == NULL || pthread_mutex_init(&w->lock, NULL) != 0) {
+        free(w->path);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+
+void snapshot_writer_destroy(Snapshot_writer *w)
+{
+    while (w->parts != NULL) {
+        Snapshot_part *part = w->parts;
+        w->parts = part->next;
+        arena_destroy(part->paths);
+        free(part->records);
+        free(part);
+    }
+    pthread_mutex_destroy(&w->lock);
+    free(w->path);
+    free(w);
+}
+
+
+Snapshot_part *snapshot_writer_part(Snapshot_writer *w)
+{
+    Snapshot_part *part;
+
+    if ((part = calloc(1, sizeof(Snapshot_part))) == NULL) {
+        return NULL;
+    }
+    if ((part->paths = arena_create(ARENA_CHUNK_SIZE)) == NULL) {
+        free(part);
+        return NULL;
+    }
+    pthread_mutex_lock(&w->lock);
+    part->next = w->parts;
+    w->parts = part;
+    pthread_mutex_unlock(&w->lock);
+
+    return part;
+}
+
+
+bool snapshot_part_add(Snapshot_part *part, const char *path, unsigned char d_type, uint64_t blocks)
+{
+    Snapshot_record *record;
+
+    if (part->records_size == part->records_capacity) {
+        size_t new_capacity = part->records_capacity == 0 ? 4096 : part->records_capacity * 2;
+        Snapshot_record *grown;
+        if ((grown = realloc(part->records, new_capacity * sizeof(Snapshot_record))) == NULL) {
+            part->failed = true;
+            return false;
+        }
+        part->records = grown;
+        part->records_capacity = new_capacity;
+    }
+    record = &part->records[part->records_size];
+    if ((record->path = arena_strndup(part->paths, path, strlen(path))) == NULL) {
+        part->failed = true;
+        return false;
+    }
+    record->blocks = blocks;
+    record->d_type = d_type;
+    part->records_size++;
+
+    return true;
+}
+
+
+//finds the depth and subtree end of each sorted record, with a stack of the directories the current record is under
+static bool link_records(Snapshot_record *records, size_t records_size)
+{
+    size_t *open, open_size = 0;
+
+    if ((open = malloc((records_size > 0 ? records_size : 1) * sizeof(size_t))) == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < records_size; i++) {
+        while (open_size > 0 && !is_under(records[i].path, records[open[open_size - 1]].path)) {
+            records[open[--open_size]].subtree_end = i;
+        }
+        records[i].depth = (uint32_t)open_size;
+        open[open_size++] = i;
+    }
+    while (open_size > 0) {
+        records[open[--open_size]].subtree_end = records_size;
+    }
+    free(open);
+    return true;
+}
+
+
+static bool write_snapshot(FILE *file, const Snapshot_record *records, size_t records_size)
+{
+    Snapshot_header header;
+    uint64_t offset = 0, blocks = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.entries_size = records_size;
+    for (size_t i = 0; i < records_size; i++) {
+        header.names_size += strlen(records[i].path) + 1;
+    }
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    for (size_t i = 0; i < records_size; i++) {
+        Snapshot_entry entry = {.subtree_end = records[i].subtree_end, .path_offset = offset,
+                                .depth = records[i].depth, .d_type = records[i].d_type};
+        if (fwrite(&entry, sizeof(entry), 1, file) != 1) {
+            return false;
+        }
+        offset += strlen(records[i].path) + 1;
+    }
+    for (size_t i = 0; i <= records_size; i++) {
+        if (fwrite(&blocks, sizeof(blocks), 1, file) != 1) {
+            return false;
+        }
+        if (i < records_size) {
+            blocks += records[i].blocks;
+        }
+    }
+    for (size_t i = 0; i < records_size; i++) {
+        if (fwrite(records[i].path, strlen(records[i].path) + 1, 1, file) != 1) {
+            return false;
+        }
+    }
+    return fflush(file) == 0 && fsync(fileno(file)) == 0;
+}
+
+
+bool snapshot_writer_commit(Snapshot_writer *w)
+{
+    Snapshot_record *records;
+    size_t records_size = 0, len = strlen(w->path) + sizeof(".XXXXXX");
+    char *temp_path;
+    FILE *file;
+    bool ok;
+    int fd;
+
+    for (Snapshot_part *part = w->parts; part != NULL; part = part->next) {
+        if (part->failed) {
+            return false;
+        }
+        records_size += part->records_size;
+    }
+    if ((records = malloc((records_size > 0 ? records_size : 1) * sizeof(Snapshot_record))) == NULL) {
+        return false;
+    }
+    records_size = 0;
+    for (Snapshot_part *part = w->parts; part != NULL; part = part->next) {
+        if (part->records_size == 0) {
+            continue;
+        }
+        memcpy(records + records_size, part->records, part->records_size * sizeof(Snapshot_record));
+        records_size += part->records_size;
+    }
+    qsort(records, records_size, sizeof(Snapshot_record), compare_records);
+    if (!link_records(records, records_size) || (temp_path = malloc(len)) == NULL) {
+        free(records);
+        return false;
+    }
+
+    snprintf(temp_path, len, "%s.XXXXXX", w->path);
+    if ((fd = mkostemp(temp_path, O_CLOEXEC)) < 0) {
+        free(temp_path);
+        free(records);
+        return false;
+    }
+    if ((file = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        unlink(temp_path);
+        free(temp_path);
+        free(records);
+        return false;
+    }
+    ok = write_snapshot(file, records, records_size);
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (ok && rename(temp_path, w->path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    free(records);
+    return ok;
+}
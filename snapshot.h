@@ -0,0 +1,142 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/**
+ * @defgroup snapshot_h Tree snapshot
+ *
+ * @brief This module is used to save the result of a traversal, so the
+ * usage of any part of the tree can be asked for later without
+ * touching the file system.
+ *
+ * A snapshot file holds every entry in pre-order: a directory is
+ * followed by everything under it. Each entry knows where its subtree
+ * ends, and the block counts are summed up in order, so the usage of a
+ * subtree is the difference of two sums. Entries are found by binary
+ * search on their paths, which are ordered as the entries are.
+ *
+ * A snapshot is written in parts, one per thread, so no locks are
+ * needed while traversing. The parts are sorted into pre-order when
+ * committed, and the file is replaced atomically.
+ *
+ * A snapshot is read by mapping the file into memory.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * The type for a snapshot that is read.
+*/
+typedef struct snapshot Snapshot;
+
+
+/**
+ * The type for a snapshot that is written.
+*/
+typedef struct snapshot_writer Snapshot_writer;
+
+
+/**
+ * The type for the entries written by one thread.
+*/
+typedef struct snapshot_part Snapshot_part;
+
+
+/**
+ * @brief Opens snapshot file for reading.
+ *
+ * @param path       path of snapshot file.
+ * @return           Snapshot pointer to the opened snapshot, NULL if the
+ *                   file does not exist or is not a valid snapshot.
+ */
+Snapshot *snapshot_open(const char *path);
+
+
+/**
+ * @brief Closes snapshot.
+ *
+ * @param snap       Snapshot pointer to snapshot to be closed.
+ */
+void snapshot_close(Snapshot *snap);
+
+
+/**
+ * @brief Finds an entry by the path it was traversed with.
+ *
+ * @param snap       Snapshot pointer to snapshot.
+ * @param path       path of entry, trailing '/' are ignored.
+ * @return           index of entry, -1 if there is none.
+ */
+long snapshot_find(Snapshot *snap, const char *path);
+
+
+/**
+ * @brief Returns the summed block count of an entry and everything under it.
+ *
+ * @param snap       Snapshot pointer to snapshot.
+ * @param index      index of entry, as returned by snapshot_find.
+ * @return           number of 512-byte blocks.
+ */
+uint64_t snapshot_subtree_blocks(Snapshot *snap, long index);
+
+
+/**
+ * @brief Returns the number of entries of an entry's subtree, itself included.
+ *
+ * @param snap       Snapshot pointer to snapshot.
+ * @param index      index of entry, as returned by snapshot_find.
+ * @return           number of entries.
+ */
+uint64_t snapshot_subtree_size(Snapshot *snap, long index);
+
+
+/**
+ * @brief Create and return a writer of a new snapshot.
+ *
+ * @param path       path of snapshot file to be written by snapshot_writer_commit.
+ * @return           Snapshot_writer pointer to the created writer, NULL on failure.
+ */
+Snapshot_writer *snapshot_writer_create(const char *path);
+
+
+/**
+ * @brief Destroys writer and its parts, without writing the snapshot if it was not committed.
+ *
+ * @param w          Snapshot_writer pointer to writer to be destroyed.
+ */
+void snapshot_writer_destroy(Snapshot_writer *w);
+
+
+/**
+ * @brief Adds a part to writer, for one thread to add entries to. Thread-safe.
+ *
+ * @param w          Snapshot_writer pointer to writer.
+ * @return           Snapshot_part pointer to the part, NULL on failure.
+ */
+Snapshot_part *snapshot_writer_part(Snapshot_writer *w);
+
+
+/**
+ * @brief Adds an entry to a part.
+ *
+ * @param part       part of the calling thread.
+ * @param path       path of entry, as traversed.
+ * @param d_type     DT_* type of entry.
+ * @param blocks     number of 512-byte blocks of entry.
+ * @return           true on success, false on failure (the commit then fails).
+ */
+bool snapshot_part_add(Snapshot_part *part, const char *path, unsigned char d_type, uint64_t blocks);
+
+
+/**
+ * @brief Sorts the entries of all parts into the snapshot file, which is replaced atomically.
+ *
+ * @param w          Snapshot_writer pointer to writer.
+ * @return           true on success, false on failure.
+ */
+bool snapshot_writer_commit(Snapshot_writer *w);
+
+#endif /* SNAPSHOT_H */
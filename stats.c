@@ -0,0 +1,113 @@
+#include "stats.h"
+#include <stdlib.h>
+
+#define NS_PER_MS 1e6
+#define NS_PER_US 1e3
+
+static const char *op_names[DWAF_OPS_SIZE] = {"open", "getdents64", "statx", "io_uring wait", "callback"};
+
+
+static int bucket_of(unsigned long long ns)
+{
+    int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+
+    return bucket < DWAF_HISTOGRAM_SIZE ? bucket : DWAF_HISTOGRAM_SIZE - 1;
+}
+
+
+void stats_record(Dwaf_thread_stats *stats, Dwaf_op op, long long ns)
+{
+    if (ns < 0) {
+        ns = 0;
+    }
+    stats->op_count[op]++;
+    stats->op_ns[op] += (unsigned long long)ns;
+    stats->histogram[op][bucket_of((unsigned long long)ns)]++;
+    if (op != DWAF_OP_CALLBACK) {
+        stats->syscalls++;
+    }
+}
+
+
+void stats_add(Dwaf_thread_stats *sum, const Dwaf_thread_stats *stats)
+{
+    sum->dirs += stats->dirs;
+    sum->files += stats->files;
+    sum->syscalls += stats->syscalls;
+    sum->path_bytes += stats->path_bytes;
+    sum->idle_ns += stats->idle_ns;
+    sum->lock_ns += stats->lock_ns;
+    for (int op = 0; op < DWAF_OPS_SIZE; op++) {
+        sum->op_count[op] += stats->op_count[op];
+        sum->op_ns[op] += stats->op_ns[op];
+        for (int i = 0; i < DWAF_HISTOGRAM_SIZE; i++) {
+            sum->histogram[op][i] += stats->histogram[op][i];
+        }
+    }
+}
+
+
+//upper bound of the bucket holding the times of op below which fraction of them are
+static unsigned long long percentile_ns(const Dwaf_thread_stats *stats, Dwaf_op op, double fraction)
+{
+    unsigned long long rank = (unsigned long long)(fraction * stats->op_count[op]);
+    unsigned long long seen = 0;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int i = 0; i < DWAF_HISTOGRAM_SIZE; i++) {
+        if ((seen += stats->histogram[op][i]) >= rank) {
+            return 2ULL << i;
+        }
+    }
+    return 2ULL << (DWAF_HISTOGRAM_SIZE - 1);
+}
+
+
+void dwaf_stats_print(const Dwaf_stats *stats, FILE *out)
+{
+    const Dwaf_thread_stats *total = &stats->total;
+    double wall_s = stats->wall_ns / 1e9;
+
+    fprintf(out, "wall time %.3f s with %d threads: %llu directories, %llu files (%.0f files/s), "
+                "%llu system calls, %llu bytes of paths copied\n",
+            wall_s, stats->threads_size, total->dirs, total->files, 
+            wall_s > 0 ? total->files / wall_s : 0.0, total->syscalls, total->path_bytes);
+
+    //percentiles are upper bounds of power-of-2 buckets
+    fprintf(out, "%-14s %10s %12s %10s %10s %10s %10s\n", 
+            "operation", "count", "total ms", "mean us", "p50 <us", "p90 <us", "p99 <us");
+    for (int op = 0; op < DWAF_OPS_SIZE; op++) {
+        if (total->op_count[op] == 0) {
+            continue;
+        }
+        fprintf(out, "%-14s %10llu %12.1f %10.1f %10.1f %10.1f %10.1f\n", op_names[op], total->op_count[op], 
+                total->op_ns[op] / NS_PER_MS, total->op_ns[op] / NS_PER_US / total->op_count[op],
+                percentile_ns(total, op, 0.5) / NS_PER_US, percentile_ns(total, op, 0.9) / NS_PER_US, 
+                percentile_ns(total, op, 0.99) / NS_PER_US);
+    }
+
+    fprintf(out, "%-6s %10s %10s %12s %10s %10s %12s\n", 
+            "thread", "dirs", "files", "syscall ms", "idle ms", "lock ms", "callback ms");
+    for (int i = 0; i < stats->threads_size; i++) {
+        const Dwaf_thread_stats *thread = &stats->threads[i];
+        unsigned long long syscall_ns = 0;
+        for (int op = 0; op < DWAF_OPS_SIZE; op++) {
+            if (op != DWAF_OP_CALLBACK) {
+                syscall_ns += thread->op_ns[op];
+            }
+        }
+        fprintf(out, "%-6d %10llu %10llu %12.1f %10.1f %10.1f %12.1f\n", i, thread->dirs, thread->files, 
+                syscall_ns / NS_PER_MS, thread->idle_ns / NS_PER_MS, thread->lock_ns / NS_PER_MS, 
+                thread->op_ns[DWAF_OP_CALLBACK] / NS_PER_MS);
+    }
+}
+
+
+void dwaf_stats_free(Dwaf_stats *stats)
+{
+    free(stats->threads);
+    stats->threads = NULL;
+    stats->threads_size = 0;
+}
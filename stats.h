@@ -0,0 +1,41 @@
+#ifndef STATS_H
+#define STATS_H
+
+/**
+ * @defgroup stats_h Stats
+ *
+ * @brief This module is used to count and time what the threads of a
+ * traversal do, for finding out where the time of a slow traversal goes.
+ *
+ * Each thread counts into its own Dwaf_thread_stats, so counting needs
+ * no atomics or locks; the threads' stats are summed when the traversal
+ * is done. Latencies are kept in histograms of power-of-2 buckets, so
+ * recording one is a few additions whatever the number of operations.
+ *
+ * The stats are given to the user with the "dwaf_stats_*" functions of
+ * directory_traverser.h.
+ *
+ */
+
+#include "directory_traverser.h"
+
+
+/**
+ * @brief Records one timed operation of a thread.
+ *
+ * @param stats      the thread's stats.
+ * @param op         kind of operation, counted as a system call unless it is DWAF_OP_CALLBACK.
+ * @param ns         time the operation took, in nanoseconds.
+ */
+void stats_record(Dwaf_thread_stats *stats, Dwaf_op op, long long ns);
+
+
+/**
+ * @brief Adds the counters of stats to sum.
+ *
+ * @param sum        stats added to.
+ * @param stats      stats to add.
+ */
+void stats_add(Dwaf_thread_stats *sum, const Dwaf_thread_stats *stats);
+
+#endif /* STATS_H */
@@ -0,0 +1,167 @@
+#include "trace.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MIN_EVENTS 4096
+#define CACHE_LINE_SIZE 64
+#define WRITE_BUF_SIZE (1 << 20)
+
+//one event, a span of time of one thread
+typedef struct Trace_event {
+    long start_ns;
+    long end_ns;
+    const char *path;               //NULL if the event is not about a directory
+    long arg;
+    int kind;
+} Trace_event;
+
+//events of one thread, alone on its cache lines
+struct Trace_buf {
+    Trace_event *events;
+    size_t size;
+    size_t capacity;
+    unsigned long dropped;          //events not recorded since the buffer was full
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct Trace {
+    Trace_buf *bufs;
+    int threads_size;
+    long start_ns;
+};
+
+static const char *kind_names[TRACE_KINDS_SIZE] = {
+    "open", "getdents64", "statx", "io_uring wait", "callback", "directory", "close", "push", "steal", "idle", "chunk"
+};
+
+//name of the argument of each kind of event, NULL for none
+static const char *arg_names[TRACE_KINDS_SIZE] = {
+    NULL, NULL, NULL, NULL, NULL, "entries", NULL, "dirs", "items", "parked", "entries"
+};
+
+
+Trace *trace_create(int threads_size, long start_ns)
+{
+    Trace *trace;
+
+    if ((trace = calloc(1, sizeof(Trace))) == NULL) {
+        return NULL;
+    }
+    if ((trace->bufs = aligned_alloc(CACHE_LINE_SIZE, threads_size * sizeof(Trace_buf))) == NULL) {
+        free(trace);
+        return NULL;
+    }
+    memset(trace->bufs, 0, threads_size * sizeof(Trace_buf));
+    trace->threads_size = threads_size;
+    trace->start_ns = start_ns;
+    return trace;
+}
+
+
+void trace_destroy(Trace *trace)
+{
+    for (int i = 0; i < trace->threads_size; i++) {
+        free(trace->bufs[i].events);
+    }
+    free(trace->bufs);
+    free(trace);
+}
+
+
+Trace_buf *trace_buf(Trace *trace, int thread)
+{
+    return &trace->bufs[thread];
+}
+
+
+void trace_add(Trace_buf *buf, Trace_kind kind, long start_ns, long end_ns, const char *path, long arg)
+{
+    Trace_event *event;
+
+    if (buf->size == buf->capacity) {
+        size_t new_capacity = buf->capacity == 0 ? TRACE_MIN_EVENTS : buf->capacity * 2;
+        Trace_event *events;
+        if (new_capacity > TRACE_MAX_EVENTS || (events = realloc(buf->events, new_capacity * sizeof(Trace_event))) == NULL) {
+            buf->dropped++;
+            return;
+        }
+        buf->events = events;
+        buf->capacity = new_capacity;
+    }
+    event = &buf->events[buf->size++];
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    event->path = path;
+    event->arg = arg;
+    event->kind = kind;
+}
+
+
+//writes str as a JSON string
+static void write_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char*)str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+
+//writes a complete event ("ph":"X"), with times in microseconds since the traversal started
+static void write_event(FILE *out, const Trace *trace, int thread, const Trace_event *event)
+{
+    long start = event->start_ns - trace->start_ns;
+    long duration = event->end_ns > event->start_ns ? event->end_ns - event->start_ns : 0;
+
+    fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%ld.%03ld,\"dur\":%ld.%03ld",
+            kind_names[event->kind], thread, start / 1000, start % 1000, duration / 1000, duration % 1000);
+    if (event->path != NULL || arg_names[event->kind] != NULL) {
+        fputs(",\"args\":{", out);
+        if (event->path != NULL) {
+            fputs("\"path\":", out);
+            write_json_string(out, event->path);
+        }
+        if (arg_names[event->kind] != NULL) {
+            fprintf(out, "%s\"%s\":%ld", event->path != NULL ? "," : "", arg_names[event->kind], event->arg);
+        }
+        fputc('}', out);
+    }
+    fputc('}', out);
+}
+
+
+bool trace_write(Trace *trace, const char *path)
+{
+    FILE *out;
+    unsigned long dropped = 0;
+    bool ok;
+
+    if ((out = fopen(path, "w")) == NULL) {
+        return false;
+    }
+    setvbuf(out, NULL, _IOFBF, WRITE_BUF_SIZE);
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"do-with-all-files\"}}", out);
+    for (int i = 0; i < trace->threads_size; i++) {
+        const Trace_buf *buf = &trace->bufs[i];
+        if (buf->size == 0 && buf->dropped == 0) {
+            continue;                   //not started, or took no part
+        }
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", i, i);
+        for (size_t j = 0; j < buf->size; j++) {
+            write_event(out, trace, i, &buf->events[j]);
+        }
+        dropped += buf->dropped;
+    }
+    fprintf(out, "\n],\"otherData\":{\"dropped_events\":%lu}}\n", dropped);
+    ok = !ferror(out);
+    return fclose(out) == 0 && ok;
+}
@@ -0,0 +1,101 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+ * @defgroup trace_h Trace
+ *
+ * @brief This module is used to record when each thread of a traversal
+ * did what, and to write it out as a Chrome trace-event JSON file that
+ * trace viewers (chrome://tracing, Perfetto) show as one timeline per
+ * thread.
+ *
+ * Each thread records into a buffer of its own, which no other thread
+ * touches while traversing, so recording takes no locks or atomics. A
+ * buffer grows in chunks up to TRACE_MAX_EVENTS; events past that are
+ * counted as dropped rather than recorded. The events keep pointers to
+ * the paths of directories, which must stay valid until the trace is
+ * written.
+ *
+ */
+
+#include "directory_traverser.h"
+#include <stdbool.h>
+
+#define TRACE_MAX_EVENTS (1 << 22)      //most events recorded per thread
+
+/**
+ * Kinds of events, the first ones are the timed operations of Dwaf_op.
+ */
+typedef enum Trace_kind {
+    TRACE_OPEN = DWAF_OP_OPEN,
+    TRACE_GETDENTS = DWAF_OP_GETDENTS,
+    TRACE_STATX = DWAF_OP_STATX,
+    TRACE_URING = DWAF_OP_URING,
+    TRACE_CALLBACK = DWAF_OP_CALLBACK,
+    TRACE_DIR,                          //a directory read (or replayed), with its path and number of entries
+    TRACE_CLOSE,
+    TRACE_PUSH,                         //sub-directories queued, with their number
+    TRACE_STEAL,                        //directories or chunks stolen from another thread, with their number
+    TRACE_IDLE,                         //looking for work, or parked (arg 1) by the tuning of active threads
+    TRACE_CHUNK,                        //a chunk of a huge directory's entries handled, with its path and number of entries
+    TRACE_KINDS_SIZE
+} Trace_kind;
+
+/**
+ * The type for the trace of a traversal, and for the buffer of one of its threads.
+*/
+typedef struct Trace Trace;
+typedef struct Trace_buf Trace_buf;
+
+
+/**
+ * @brief Create and return a trace with a buffer for each thread.
+ *
+ * @param threads_size   number of threads.
+ * @param start_ns       CLOCK_MONOTONIC time the traversal started, the zero of the timeline.
+ * @return               Trace pointer to the created trace, NULL on failure.
+ */
+Trace *trace_create(int threads_size, long start_ns);
+
+
+/**
+ * @brief Destroys trace.
+ *
+ * @param trace      Trace pointer to trace to be destroyed.
+ */
+void trace_destroy(Trace *trace);
+
+
+/**
+ * @brief Returns the buffer of a thread, to be used by that thread only.
+ *
+ * @param trace      Trace pointer to trace.
+ * @param thread     index of thread.
+ * @return           Trace_buf pointer to the thread's buffer.
+ */
+Trace_buf *trace_buf(Trace *trace, int thread);
+
+
+/**
+ * @brief Records an event of the thread owning buf.
+ *
+ * @param buf        Trace_buf pointer to the thread's buffer.
+ * @param kind       kind of event.
+ * @param start_ns   CLOCK_MONOTONIC time the event started.
+ * @param end_ns     CLOCK_MONOTONIC time the event ended.
+ * @param path       path of the directory the event is about, or NULL.
+ * @param arg        number the event is about, see Trace_kind.
+ */
+void trace_add(Trace_buf *buf, Trace_kind kind, long start_ns, long end_ns, const char *path, long arg);
+
+
+/**
+ * @brief Writes the trace as Chrome trace-event JSON, when no thread records into it.
+ *
+ * @param trace      Trace pointer to trace.
+ * @param path       path of file to write.
+ * @return           true on success, false on failure.
+ */
+bool trace_write(Trace *trace, const char *path);
+
+#endif /* TRACE_H */
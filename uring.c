@@ -0,0 +1,322 @@
+#include "uring.h"
+#include <stdlib.h>
+
+#ifdef DWAF_IO_URING
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+//mapped submission and completion rings
+struct uring {
+    int fd;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int to_submit;         //queued but not yet submitted
+    unsigned int in_flight;         //submitted but not yet taken off the completion ring
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;                   //same as sq_map if the kernel maps both rings at once
+    size_t cq_map_size;
+    size_t sqes_size;
+};
+
+
+static unsigned int load_acquire(unsigned int *p)
+{
+    return atomic_load_explicit((_Atomic unsigned int*)p, memory_order_acquire);
+}
+
+
+static void store_release(unsigned int *p, unsigned int v)
+{
+    atomic_store_explicit((_Atomic unsigned int*)p, v, memory_order_release);
+}
+
+
+Uring *uring_create(unsigned int entries)
+{
+    struct io_uring_params params;
+    Uring *ring;
+
+    if ((ring = calloc(1, sizeof(Uring))) == NULL) {
+        return NULL;
+    }
+    memset(&params, 0, sizeof(params));
+    if ((ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+        ring->cq_map_size = ring->sq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            munmap(ring->sq_map, ring->sq_map_size);
+            close(ring->fd);
+            free(ring);
+            return NULL;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_map != ring->sq_map) {
+            munmap(ring->cq_map, ring->cq_map_size);
+        }
+        munmap(ring->sq_map, ring->sq_map_size);
+        close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_head = (unsigned int*)((char*)ring->sq_map + params.sq_off.head);
+    ring->sq_tail = (unsigned int*)((char*)ring->sq_map + params.sq_off.tail);
+    ring->sq_mask = *(unsigned int*)((char*)ring->sq_map + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)((char*)ring->sq_map + params.sq_off.array);
+    ring->cq_head = (unsigned int*)((char*)ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)((char*)ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int*)((char*)ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_map + params.cq_off.cqes);
+
+    return ring;
+}
+
+
+void uring_destroy(Uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    free(ring);
+}
+
+
+//returns a zeroed submission entry at the tail of the ring, NULL if full
+static struct io_uring_sqe *get_sqe(Uring *ring)
+{
+    unsigned int tail = *ring->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    if (tail - load_acquire(ring->sq_head) > ring->sq_mask) {
+        return NULL;
+    }
+    sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+    return sqe;
+}
+
+
+//publishes the entry returned by get_sqe to the kernel
+static void push_sqe(Uring *ring)
+{
+    store_release(ring->sq_tail, *ring->sq_tail + 1);
+    ring->to_submit++;
+}
+
+
+bool uring_queue_statx(Uring *ring, int dir_fd, const char *name, int flags, unsigned int mask,
+                        struct statx *stx, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = get_sqe(ring)) == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dir_fd;
+    sqe->addr = (uint64_t)(uintptr_t)name;
+    sqe->len = mask;
+    sqe->off = (uint64_t)(uintptr_t)stx;
+    sqe->statx_flags = (uint32_t)flags;
+    sqe->user_data = user_data;
+    push_sqe(ring);
+    return true;
+}
+
+
+bool uring_queue_openat(Uring *ring, int dir_fd, const char *name, int flags, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = get_sqe(ring)) == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dir_fd;
+    sqe->addr = (uint64_t)(uintptr_t)name;
+    sqe->open_flags = (uint32_t)flags;
+    sqe->user_data = user_data;
+    push_sqe(ring);
+    return true;
+}
+
+
+//takes back the calls queued but not submitted, which the kernel only reads when they are submitted
+static void discard_unsubmitted(Uring *ring)
+{
+    store_release(ring->sq_tail, *ring->sq_tail - ring->to_submit);
+    ring->to_submit = 0;
+}
+
+
+//waits until given number of submitted calls have completed
+static bool wait_completions(Uring *ring, unsigned int wait_nr)
+{
+    int ret;
+
+    while (wait_nr > 0) {
+        ret = (int)syscall(__NR_io_uring_enter, ring->fd, 0, wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0) {
+            break;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool uring_submit_and_wait(Uring *ring, unsigned int wait_nr)
+{
+    int ret;
+
+    while (ring->to_submit > 0) {
+        ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret == 0 || (ret < 0 && errno != EINTR)) {       //nothing consumed would loop forever
+            discard_unsubmitted(ring);
+            return false;
+        }
+        if (ret > 0) {
+            ring->to_submit -= (unsigned int)ret;
+            ring->in_flight += (unsigned int)ret;
+            if (ring->to_submit == 0) {
+                return true;                //waited for completions in the same call
+            }
+        }
+    }
+    //some calls were submitted by earlier calls, wait for the completions only
+    return wait_completions(ring, wait_nr);
+}
+
+
+bool uring_next_completion(Uring *ring, uint64_t *user_data, int *res)
+{
+    unsigned int head = *ring->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == load_acquire(ring->cq_tail)) {
+        return false;
+    }
+    cqe = &ring->cqes[head & ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    store_release(ring->cq_head, head + 1);
+    if (ring->in_flight > 0) {
+        ring->in_flight--;
+    }
+    return true;
+}
+
+
+bool uring_drain(Uring *ring, bool close_fds)
+{
+    uint64_t user_data;
+    int res;
+
+    discard_unsubmitted(ring);
+    while (ring->in_flight > 0) {
+        if (uring_next_completion(ring, &user_data, &res)) {
+            if (close_fds && res >= 0) {
+                close(res);
+            }
+        } else if (!wait_completions(ring, 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#else
+
+Uring *uring_create(unsigned int entries)
+{
+    return NULL;
+}
+
+
+void uring_destroy(Uring *ring)
+{
+}
+
+
+bool uring_queue_statx(Uring *ring, int dir_fd, const char *name, int flags, unsigned int mask,
+                        struct statx *stx, uint64_t user_data)
+{
+    return false;
+}
+
+
+bool uring_queue_openat(Uring *ring, int dir_fd, const char *name, int flags, uint64_t user_data)
+{
+    return false;
+}
+
+
+bool uring_submit_and_wait(Uring *ring, unsigned int wait_nr)
+{
+    return false;
+}
+
+
+bool uring_next_completion(Uring *ring, uint64_t *user_data, int *res)
+{
+    return false;
+}
+
+
+bool uring_drain(Uring *ring, bool close_fds)
+{
+    return true;
+}
+
+#endif
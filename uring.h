@@ -0,0 +1,116 @@
+#ifndef URING_H
+#define URING_H
+
+/**
+ * @defgroup uring_h Uring
+ *
+ * @brief This module is used to submit file metadata operations
+ * asynchronously in batches with Linux io_uring.
+ *
+ * Only the operations the traverser needs (statx and openat) are
+ * supported, and the ring is driven with the raw system calls so no
+ * library is needed. One ring is meant to be owned by one thread.
+ *
+ * The module is only compiled in when DWAF_IO_URING is defined
+ * ('make IO_URING=1'), otherwise uring_create always fails and the
+ * callers keep to their synchronous system calls. It also fails when
+ * the running kernel does not support or allow io_uring.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/stat.h>
+
+
+/**
+ * The type for the ring.
+*/
+typedef struct uring Uring;
+
+
+/**
+ * @brief Create and return a ring.
+ *
+ * @param entries    number of operations that can be queued at once.
+ * @return           Uring pointer to the created ring, NULL if io_uring
+ *                   is not compiled in or not available.
+ */
+Uring *uring_create(unsigned int entries);
+
+
+/**
+ * @brief Destroys ring.
+ *
+ * @param ring       Uring pointer to ring to be destroyed.
+ */
+void uring_destroy(Uring *ring);
+
+
+/**
+ * @brief Queues a statx call, to be submitted with uring_submit_and_wait.
+ *
+ * The name and the statx buffer must stay valid until the call has completed.
+ *
+ * @param ring       Uring pointer to ring.
+ * @param dir_fd     directory name is relative to.
+ * @param name       name of file.
+ * @param flags      AT_* flags as for statx.
+ * @param mask       STATX_* fields to fetch.
+ * @param stx        buffer filled in by the call.
+ * @param user_data  value handed back with the call's completion.
+ * @return           true if queued, false if the ring is full.
+ */
+bool uring_queue_statx(Uring *ring, int dir_fd, const char *name, int flags, unsigned int mask,
+                        struct statx *stx, uint64_t user_data);
+
+
+/**
+ * @brief Queues an openat call, to be submitted with uring_submit_and_wait.
+ *
+ * The name must stay valid until the call has completed.
+ *
+ * @param ring       Uring pointer to ring.
+ * @param dir_fd     directory name is relative to.
+ * @param name       name of file.
+ * @param flags      O_* flags as for openat.
+ * @param user_data  value handed back with the call's completion.
+ * @return           true if queued, false if the ring is full.
+ */
+bool uring_queue_openat(Uring *ring, int dir_fd, const char *name, int flags, uint64_t user_data);
+
+
+/**
+ * @brief Submits all queued calls and waits until given number of calls have completed.
+ *
+ * @param ring       Uring pointer to ring.
+ * @param wait_nr    number of completions to wait for.
+ * @return           true on success, false on failure.
+ */
+bool uring_submit_and_wait(Uring *ring, unsigned int wait_nr);
+
+
+/**
+ * @brief Takes the next completion off the ring.
+ *
+ * @param ring       Uring pointer to ring.
+ * @param user_data  set to the value the call was queued with.
+ * @param res        set to the call's result (negative errno on failure).
+ * @return           true if there was a completion, false if none has arrived.
+ */
+bool uring_next_completion(Uring *ring, uint64_t *user_data, int *res);
+
+
+/**
+ * @brief Gives up the calls on the ring after a failure: calls queued but
+ * not submitted are dropped, and every submitted call is waited for and
+ * its completion thrown away, so the kernel no longer uses the buffers
+ * the calls were given.
+ *
+ * @param ring       Uring pointer to ring.
+ * @param close_fds  true if the calls are opens, whose returned file descriptors are closed.
+ * @return           true if no call is left in flight, false if waiting failed.
+ */
+bool uring_drain(Uring *ring, bool close_fds);
+
+#endif /* URING_H */
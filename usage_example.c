@@ -7,66 +7,315 @@
  * 
  * How to use (this example) on Linux:
  * 1. Make program ready for use by running 'make'
- * 2. Run ./dwaf [file name] [number of threads to use]
+ * 2. Run ./dwaf [-s snapshot file] [-p | -0] [-l] [-x pattern]... [-d depth] [--stats] [--trace file] [--order depth|breadth|hybrid] [file name] [number of threads to use] [cache file (optional)]
+ *    or ./dwaf -q [snapshot file] [path]...
  * 
  * Explanation of arguments:
  * [file name] file whos space usage is estimated, if directory-file 
  *                all files in directory and subdirectories are included
  * 
- * [-j number of threads to use] number of threads that will be used to traverse given file
+ * [-j number of threads to use] number of threads that will be used to traverse given file,
+ *                0 to let the traversal tune it as it goes
+ * 
+ * [cache file] if given, directories that did not change since the last run 
+ *                with the same cache file are not read again
+ * 
+ * [-s snapshot file] also save the usage of every file to snapshot file
+ * 
+ * [-p | -0] instead of the usage, print the path of every file, each followed 
+ *                by a newline (-p) or a NUL-character (-0), like 'find -print0'
+ * 
+ * [-l] count a file with several hard links once for each link (like 'du -l'), 
+ *                by default it is counted once (like 'du')
+ * 
+ * [-x pattern] leave out files whose name matches pattern (like '.git' or '*.o'),
+ *                directories with everything under them, may be given many times
+ * 
+ * [-d depth] leave out files more than depth directories below file name
+ * 
+ * [-q snapshot file] instead of traversing, print the usage of each path as 
+ *                saved in snapshot file (paths as they were traversed)
+ * 
+ * [--stats] also print what the threads did and how long it took to stderr
+ * 
+ * [--trace file] also write when each thread did what to file, to be opened
+ *                in chrome://tracing or Perfetto
+ * 
+ * [--order depth|breadth|hybrid] order to read directories in, depth-first
+ *                by default
  */
 
 #include "directory_traverser.h"
 #include "get_opts_help.h"
+#include "snapshot.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <pthread.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <getopt.h>
 #include <sys/stat.h>
 
 //success-statuses
 #define SUCCESS 0
 #define FAILURE 1
 
+#define PRINT_BUF_SIZE (256 * 1024)
+
+#define STATS_OPT 256               //getopt value of --stats, which has no short form
+#define TRACE_OPT 257               //getopt value of --trace, which has no short form
+#define ORDER_OPT 258               //getopt value of --order, which has no short form
+
+#define USAGE "./dwaf [-s snapshot file] [-p | -0] [-l] [-x pattern]... [-d depth] [--stats] [--trace file] [--order depth|breadth|hybrid] [file name] [number of threads to use] [cache file (optional)]\n" \
+                "    or ./dwaf -q [snapshot file] [path]..."
+
 
 /**
- * Struct that will be used as argument to 'do_with_all_files'  
+ * Struct that will be used as argument to 'reduce_all_entries'  
  * 
- * Holds usage of one file and has objects used to 
- * coordinate threads
+ * Holds usage of one file, the usage counted by each thread
+ * is merged into it when the traversal is done
  */
 typedef struct file_usage {
     int success_status;
     char *file;
     long usage;
-    pthread_mutex_t modify_lock;
+    Snapshot_writer *snapshot;      //NULL if no snapshot is saved
 } file_usage;
 
 
 /**
- * The function that will be used in 'do_with_all_files' 
+ * The state each thread counts usage in, no other thread 
+ * touches it so no lock is needed
+ */
+typedef struct usage_count {
+    int success_status;
+    long usage;
+    Snapshot_part *part;            //the thread's part of the snapshot, if saved
+} usage_count;
+
+
+/**
+ * Struct that will be used as argument to 'reduce_all_entries' when printing paths
  * 
- * Counts up given file-usage with usage of given file
+ * The lock is only held while a thread writes out a full buffer, 
+ * so the lines of two threads never mix
+ */
+typedef struct path_printer {
+    int success_status;
+    char delimiter;
+    pthread_mutex_t lock;
+} path_printer;
+
+
+/**
+ * The state each thread prints paths to, written out with 
+ * one call to 'write' when full
+ */
+typedef struct print_buffer {
+    int success_status;
+    size_t used;
+    char data[PRINT_BUF_SIZE];
+} print_buffer;
+
+
+/**
+ * Starts a thread's count of usage
  * 
- * @param file_path path to file
+ * @param state usage-count of thread
  * @param arg file-usage struct
  */
-void count_up_file_size(char *file_path, void *arg) {
+static void start_count(void *state, void *arg) {
+    usage_count *count = (usage_count*)state;
     file_usage *fu = (file_usage*)arg;
-    struct stat temp_file_stats;
+
+    count->success_status = SUCCESS;
+    count->usage = 0;
+    if (fu->snapshot != NULL && (count->part = snapshot_writer_part(fu->snapshot)) == NULL) {
+        count->success_status = FAILURE;
+    }
+}
+
+
+/**
+ * The function that will be used in 'reduce_all_entries' 
+ * 
+ * Counts up the thread's usage-count with usage of given file. The 
+ * traverser has already fetched the file's block count (see 'main'), 
+ * so no further stat is needed here.
+ * 
+ * @param state usage-count of the calling thread
+ * @param entry encountered file
+ * @param arg file-usage struct
+ */
+static void count_up_file_size(void *state, Dwaf_entry *entry, void *arg) {
+    usage_count *count = (usage_count*)state;
     
-    if ((lstat(file_path, &temp_file_stats)) < 0) {
-        fprintf(stderr, "Could not get usage of '%s'\n", file_path);
+    if (!(entry->stx_mask & STATX_BLOCKS)) {
+        fprintf(stderr, "Could not get usage of '%s'\n", entry->path);
+        count->success_status = FAILURE;
+        return;
+    }
+    count->usage += entry->stx.stx_blocks;
+
+    if (count->part != NULL && !snapshot_part_add(count->part, entry->path, entry->d_type, entry->stx.stx_blocks)) {
+        count->success_status = FAILURE;
+    }
+}
+
+
+/**
+ * Adds a thread's usage-count to the file-usage, called once per
+ * thread when the traversal is done (never by two threads at once)
+ * 
+ * @param state usage-count of thread
+ * @param arg file-usage struct
+ */
+static void merge_count(void *state, void *arg) {
+    usage_count *count = (usage_count*)state;
+    file_usage *fu = (file_usage*)arg;
+
+    fu->usage += count->usage;
+    if (count->success_status != SUCCESS) {
         fu->success_status = FAILURE;
+    }
+}
+
+/**
+ * Writes data to standard output, while no other thread does
+ * 
+ * @param printer path-printer struct
+ * @param data data to write
+ * @param size number of bytes of data
+ * @return int SUCCESS if all of data was written, else FAILURE
+ */
+static int write_out(path_printer *printer, const char *data, size_t size) {
+    int status = SUCCESS;
+
+    pthread_mutex_lock(&printer->lock);
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("usage_example: could not print paths");
+            status = FAILURE;
+            break;
+        }
+        data += written;
+        size -= written;
+    }
+    pthread_mutex_unlock(&printer->lock);
+
+    return status;
+}
+
+
+/**
+ * Starts a thread's buffer of paths
+ * 
+ * @param state print-buffer of thread
+ * @param arg path-printer struct
+ */
+static void start_printing(void *state, void *arg) {
+    print_buffer *buffer = (print_buffer*)state;
+
+    buffer->success_status = SUCCESS;
+    buffer->used = 0;
+}
+
+
+/**
+ * The function that will be used in 'reduce_all_entries' when printing paths
+ * 
+ * Adds path of given file to the thread's buffer, writing out 
+ * the buffer first if the path does not fit
+ * 
+ * @param state print-buffer of the calling thread
+ * @param entry encountered file
+ * @param arg path-printer struct
+ */
+static void print_path(void *state, Dwaf_entry *entry, void *arg) {
+    print_buffer *buffer = (print_buffer*)state;
+    path_printer *printer = (path_printer*)arg;
+    size_t len = strlen(entry->path);
+
+    if (buffer->used + len + 1 > PRINT_BUF_SIZE) {
+        if (write_out(printer, buffer->data, buffer->used) != SUCCESS) {
+            buffer->success_status = FAILURE;
+        }
+        buffer->used = 0;
+    }
+    if (len + 1 > PRINT_BUF_SIZE) {             //longer than any buffer, written out on its own
+        char delimiter = printer->delimiter;
+        if (write_out(printer, entry->path, len) != SUCCESS || write_out(printer, &delimiter, 1) != SUCCESS) {
+            buffer->success_status = FAILURE;
+        }
         return;
     }
+    memcpy(buffer->data + buffer->used, entry->path, len);
+    buffer->data[buffer->used + len] = printer->delimiter;
+    buffer->used += len + 1;
+}
+
+
+/**
+ * Writes out what is left in a thread's buffer, called once per 
+ * thread when the traversal is done
+ * 
+ * @param state print-buffer of thread
+ * @param arg path-printer struct
+ */
+static void finish_printing(void *state, void *arg) {
+    print_buffer *buffer = (print_buffer*)state;
+    path_printer *printer = (path_printer*)arg;
+
+    if (buffer->used > 0 && write_out(printer, buffer->data, buffer->used) != SUCCESS) {
+        buffer->success_status = FAILURE;
+    }
+    if (buffer->success_status != SUCCESS) {
+        printer->success_status = FAILURE;
+    }
+}
+
+
+/**
+ * Prints the path of every file under given file, instead of its usage. 
+ * No metadata is needed, so no file is stat:ed.
+ * 
+ * @param files_args files-list with the given file
+ * @param num_threads number of threads to use
+ * @param cache_path cache file, or NULL
+ * @param filter files to leave out, or NULL
+ * @param delimiter character printed after each path
+ * @param stats filled in with the stats of the traversal, or NULL
+ * @param trace_path file to write the trace of the traversal to, or NULL
+ * @param order order to read directories in
+ * @return int EXIT_SUCCESS on success, else EXIT_FAILURE
+ */
+static int print_all_paths(char **files_args, int num_threads, char *cache_path, Dwaf_filter *filter, char delimiter, 
+                            Dwaf_stats *stats, char *trace_path, Dwaf_order order) {
+    path_printer printer = {.success_status = SUCCESS, .delimiter = delimiter};
+    Dwaf_config config = {.statx_mask = 0, .cache_path = cache_path, .filter = filter, .stats = stats, 
+                            .trace_path = trace_path, .order = order};
+    Dwaf_reducer reducer = {.state_size = sizeof(print_buffer), .init = start_printing, 
+                            .accumulate = print_path, .merge = finish_printing};
+    int exit_status = EXIT_SUCCESS;
+
+    pthread_mutex_init(&printer.lock, NULL);
+    if (reduce_all_entries(&reducer, (void*)&printer, files_args, 1, num_threads, &config) != 0 
+            || printer.success_status != SUCCESS) {
+        exit_status = EXIT_FAILURE;
+    }
+    pthread_mutex_destroy(&printer.lock);
 
-    pthread_mutex_lock(&fu->modify_lock);
-    fu->usage += temp_file_stats.st_blocks;     //one thread at a time counts up fu with file's usage
-    pthread_mutex_unlock(&fu->modify_lock);
+    return exit_status;
 }
 
+
 /**
  * Checks arguments to program
  * If incorrect arguments: exits on failure
@@ -75,14 +324,14 @@ void count_up_file_size(char *file_path, void *arg) {
  * @param argv 
  */
 static void arg_check(int argc, char **argv) {
-    if (argc != 3) {
-        fprintf(stderr, "usage_example: How to use the example: ./dwaf [file name] [number of threads to use]\n");
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "usage_example: How to use the example: " USAGE "\n");
         exit(EXIT_FAILURE);
     }
 
-    if (!is_number_above(argv[2], 0)) {
-        fprintf(stderr, "usage_example: How to use the example: ./dwaf [file name] [number of threads to use]\n");
-        fprintf(stderr, "(third argument should be positive integer)\n");
+    if (!is_number_above(argv[2], -1)) {
+        fprintf(stderr, "usage_example: How to use the example: " USAGE "\n");
+        fprintf(stderr, "(number of threads should be positive integer, or 0 to tune it while traversing)\n");
         exit(EXIT_FAILURE);
     }
 }
@@ -92,7 +341,6 @@ static void arg_check(int argc, char **argv) {
  * @param fu file-usage whos memory should be freed 
  */
 static void destroy_file_usage(file_usage *fu) {
-    pthread_mutex_destroy(&fu->modify_lock);
     free(fu->file);
     free(fu);
 }
@@ -108,9 +356,6 @@ static file_usage *create_file_usage(char *file) {
     if ((fu = calloc(1, sizeof(file_usage))) == NULL) {
         return NULL;
     }
-    if (pthread_mutex_init(&fu->modify_lock, NULL) != 0) {
-        return NULL;
-    }
     fu->success_status = SUCCESS;
     fu->usage = 0;
     fu->file = strdup(file);
@@ -152,10 +397,148 @@ static void print_file_usage(file_usage *fu) {
 }
 
 
+/**
+ * Prints the usage of paths as saved in a snapshot, without 
+ * touching the file system. Each usage is found in constant 
+ * time once its path is found (by binary search).
+ * 
+ * @param snapshot_path snapshot file written with -s
+ * @param paths paths to print usage of
+ * @param paths_size number of paths
+ * @return int EXIT_SUCCESS if all paths were found, else EXIT_FAILURE
+ */
+static int query_snapshot(char *snapshot_path, char **paths, int paths_size) {
+    Snapshot *snap;
+    int exit_status = EXIT_SUCCESS;
+
+    if ((snap = snapshot_open(snapshot_path)) == NULL) {
+        fprintf(stderr, "usage_example: '%s' is not a snapshot\n", snapshot_path);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < paths_size; i++) {
+        long index = snapshot_find(snap, paths[i]);
+        if (index < 0) {
+            fprintf(stderr, "usage_example: '%s' is not in snapshot '%s'\n", paths[i], snapshot_path);
+            exit_status = EXIT_FAILURE;
+            continue;
+        }
+        printf("Space usage of '%s':\t%lu\n", paths[i], (unsigned long)snapshot_subtree_blocks(snap, index));
+    }
+    snapshot_close(snap);
+
+    return exit_status;
+}
+
+
+/**
+ * Prints the stats of the traversal to stderr, after what was printed to stdout
+ * 
+ * @param stats stats to print, its memory is freed
+ */
+static void print_stats(Dwaf_stats *stats) {
+    fflush(stdout);
+    dwaf_stats_print(stats, stderr);
+    dwaf_stats_free(stats);
+}
+
+
+/**
+ * Returns the filter of the options, created on first use
+ * On failure: exits
+ * 
+ * @param filter filter of the options, NULL until created
+ * @return Dwaf_filter* the filter
+ */
+static Dwaf_filter *get_filter(Dwaf_filter **filter) {
+    if (*filter == NULL && (*filter = dwaf_filter_create()) == NULL) {
+        fprintf(stderr, "usage_example: error creating filter\n");
+        exit(EXIT_FAILURE);
+    }
+    return *filter;
+}
+
+
 int main(int argc, char **argv) {
     file_usage *fu; 
     char **files_args;
     int exit_status = EXIT_SUCCESS;
+    char *snapshot_path = NULL;
+    bool print_paths = false;
+    char delimiter = '\n';
+    Dwaf_filter *filter = NULL;
+    bool count_links = false;
+    Dwaf_stats stats = {0};
+    bool show_stats = false;
+    char *trace_path = NULL;
+    Dwaf_order order = DWAF_DEPTH_FIRST;
+    int opt;
+    struct option long_opts[] = {{"stats", no_argument, NULL, STATS_OPT}, {"trace", required_argument, NULL, TRACE_OPT}, 
+                                    {"order", required_argument, NULL, ORDER_OPT}, {NULL, 0, NULL, 0}};
+
+    while ((opt = getopt_long(argc, argv, "s:q:p0lx:d:", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case STATS_OPT:
+                show_stats = true;
+                break;
+            case TRACE_OPT:
+                trace_path = optarg;
+                break;
+            case ORDER_OPT:
+                if (strcmp(optarg, "depth") == 0) {
+                    order = DWAF_DEPTH_FIRST;
+                } else if (strcmp(optarg, "breadth") == 0) {
+                    order = DWAF_BREADTH_FIRST;
+                } else if (strcmp(optarg, "hybrid") == 0) {
+                    order = DWAF_HYBRID;
+                } else {
+                    fprintf(stderr, "usage_example: order should be depth, breadth or hybrid\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'l':
+                count_links = true;
+                break;
+            case 'x':
+                if (dwaf_filter_exclude(get_filter(&filter), optarg) != SUCCESS) {
+                    fprintf(stderr, "usage_example: error adding pattern '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'd':
+                if (!is_number_above(optarg, -1)) {
+                    fprintf(stderr, "usage_example: depth should be a non-negative integer\n");
+                    exit(EXIT_FAILURE);
+                }
+                dwaf_filter_max_depth(get_filter(&filter), atoi(optarg));
+                break;
+            case 's':
+                snapshot_path = optarg;
+                break;
+            case 'p':
+                print_paths = true;
+                delimiter = '\n';
+                break;
+            case '0':
+                print_paths = true;
+                delimiter = '\0';
+                break;
+            case 'q':
+                if (optind >= argc) {
+                    fprintf(stderr, "usage_example: How to use the example: " USAGE "\n");
+                    exit(EXIT_FAILURE);
+                }
+                return query_snapshot(optarg, argv + optind, argc - optind);
+            default:
+                fprintf(stderr, "usage_example: How to use the example: " USAGE "\n");
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (print_paths && snapshot_path != NULL) {
+        fprintf(stderr, "usage_example: -s can not be used with -p or -0\n");
+        exit(EXIT_FAILURE);
+    }
+    argc -= optind - 1;             //so the positional arguments start at argv[1]
+    argv += optind - 1;
 
     arg_check(argc, argv);
 
@@ -166,8 +549,34 @@ int main(int argc, char **argv) {
 
     files_args = create_single_files_args(fu);
 
+    if (print_paths) {
+        exit_status = print_all_paths(files_args, atoi(argv[2]), argc == 4 ? argv[3] : NULL, filter, delimiter, 
+                                        show_stats ? &stats : NULL, trace_path, order);
+        if (show_stats) {
+            print_stats(&stats);
+        }
+        free(files_args[0]);
+        free(files_args);
+        destroy_file_usage(fu);
+        dwaf_filter_destroy(filter);
+        return exit_status;
+    }
+
+    if (snapshot_path != NULL && (fu->snapshot = snapshot_writer_create(snapshot_path)) == NULL) {
+        fprintf(stderr, "usage_example: can not save snapshot to '%s'\n", snapshot_path);
+        exit(EXIT_FAILURE);
+    }
+
+    Dwaf_config config = {.statx_mask = STATX_BLOCKS,      //only the block count of each file is needed
+                            .cache_path = argc == 4 ? argv[3] : NULL, .filter = filter, 
+                            .dedup_hardlinks = !count_links,     //the traverser gives each hard-linked file once
+                            .stats = show_stats ? &stats : NULL, .trace_path = trace_path, 
+                            .order = order};
+    Dwaf_reducer reducer = {.state_size = sizeof(usage_count), .init = start_count, 
+                            .accumulate = count_up_file_size, .merge = merge_count};
+
     //the function that do-with-all-files provides
-    if ((do_with_all_files(count_up_file_size, (void*)fu, files_args, 1, atoi(argv[2])) != 0)) {
+    if ((reduce_all_entries(&reducer, (void*)fu, files_args, 1, atoi(argv[2]), &config) != 0)) {
         exit_status = EXIT_FAILURE;
     }
 
@@ -177,10 +586,22 @@ int main(int argc, char **argv) {
     }
 
     print_file_usage(fu);
+    if (show_stats) {
+        print_stats(&stats);
+    }
+
+    if (fu->snapshot != NULL) {
+        if (exit_status == EXIT_SUCCESS && !snapshot_writer_commit(fu->snapshot)) {
+            fprintf(stderr, "usage_example: could not save snapshot to '%s'\n", snapshot_path);
+            exit_status = EXIT_FAILURE;
+        }
+        snapshot_writer_destroy(fu->snapshot);
+    }
     
     free(files_args[0]);
     free(files_args);
     destroy_file_usage(fu);
+    dwaf_filter_destroy(filter);
     
     return exit_status;
 }
@@ -0,0 +1,357 @@
+/**
+ * https://github.com/schmkls/do-with-all-files
+ *
+ * Watching of traversed files with inotify, so a traversal can be kept
+ * current by handling only the files that change afterwards.
+ *
+ * The interface consists of the "dwaf_watch_*" functions of directory_traverser.h
+ */
+#define _GNU_SOURCE                 //for statx
+#include "directory_traverser.h"
+#include "filter.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO \
+                    | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define EVENT_BUF_SIZE (64 * 1024)
+
+
+//a watched directory
+typedef struct Watched_dir {
+    char *path;                             //NULL if the slot is not used
+    int depth;
+    int root_index;
+} Watched_dir;
+
+struct Dwaf_watch {
+    int fd;                                 //inotify instance
+    Dwaf_context *ctx;                      //threads of the traversals of new directories
+    void (*do_with_change)(Dwaf_entry *entry, int change, void *arg);
+    void *arg;
+    Dwaf_config config;
+
+    pthread_mutex_t lock;                   //guards the watched directories while threads traverse
+    Watched_dir *dirs;                      //indexed by watch descriptor, which inotify hands out in order
+    int dirs_size;
+    bool failed;                            //a directory could not be watched, set under lock while traversing
+
+    char *events;                           //buffer events are read into
+    char *path;                             //buffer paths of events are built in
+    size_t path_size;
+};
+
+//how the entries of one traversal are given to the user
+typedef struct Watch_scan {
+    Dwaf_watch *w;
+    int change;
+    int depth_offset;                       //depth of the traversed file below its given file
+    int root_index;                         //given file the traversed file is under, -1 for the traversal's own
+} Watch_scan;
+
+
+//starts watching directory, called by the traversing threads
+static void add_watch(Dwaf_watch *w, const char *path, int depth, int root_index) {
+    int wd;
+    char *copy;
+
+    if ((copy = strdup(path)) == NULL) {
+        fprintf(stderr, "do-with-all-files: can not watch '%s'\n", path);
+        pthread_mutex_lock(&w->lock);
+        w->failed = true;
+        pthread_mutex_unlock(&w->lock);
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    if ((wd = inotify_add_watch(w->fd, path, WATCH_MASK)) < 0) {
+        if (errno != ENOENT && errno != ENOTDIR) {          //else the directory is already gone again
+            fprintf(stderr, "do-with-all-files: can not watch '%s': %s\n", path, strerror(errno));
+            w->failed = true;
+        }
+        pthread_mutex_unlock(&w->lock);
+        free(copy);
+        return;
+    }
+    if (wd >= w->dirs_size) {
+        int new_size = w->dirs_size == 0 ? 1024 : w->dirs_size;
+        Watched_dir *grown;
+        while (new_size <= wd) {
+            new_size *= 2;
+        }
+        if ((grown = realloc(w->dirs, new_size * sizeof(Watched_dir))) == NULL) {
+            fprintf(stderr, "do-with-all-files: can not watch '%s'\n", path);
+            inotify_rm_watch(w->fd, wd);
+            w->failed = true;
+            pthread_mutex_unlock(&w->lock);
+            free(copy);
+            return;
+        }
+        memset(grown + w->dirs_size, 0, (new_size - w->dirs_size) * sizeof(Watched_dir));
+        w->dirs = grown;
+        w->dirs_size = new_size;
+    }
+    free(w->dirs[wd].path);                 //a directory moved within the tree keeps its watch, but not its path
+    w->dirs[wd].path = copy;
+    w->dirs[wd].depth = depth;
+    w->dirs[wd].root_index = root_index;
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+//gives entry of a traversal to the user, after watching it if it is a directory
+static void watch_entry(Dwaf_entry *entry, void *arg) {
+    Watch_scan *scan = (Watch_scan*)arg;
+
+    entry->depth += scan->depth_offset;
+    if (scan->root_index >= 0) {
+        entry->root_index = scan->root_index;
+    }
+    //the traversal of a new directory counts depth from it, so the filter's depth is checked again here
+    if (scan->depth_offset > 0 && scan->w->config.filter != NULL 
+            && filter_skips_name(scan->w->config.filter, entry->path + entry->name_offset, entry->d_type, entry->depth)) {
+        return;
+    }
+    if (entry->d_type == DT_DIR) {
+        add_watch(scan->w, entry->path, entry->depth, entry->root_index);   //before it is read, so no change is missed
+    }
+    scan->w->do_with_change(entry, scan->change, scan->w->arg);
+}
+
+
+//traverses files with the watch's threads, watching every directory
+static int traverse_and_watch(Dwaf_watch *w, char **files, int files_size, Watch_scan *scan) {
+    Dwaf_job *job;
+
+    if ((job = dwaf_submit_entries(w->ctx, watch_entry, scan, files, files_size, &w->config)) == NULL) {
+        return FAILURE;
+    }
+    return dwaf_job_wait(w->ctx, job);
+}
+
+
+//stops watching directory at path and everything under it, for a directory moved away
+static void forget_subtree(Dwaf_watch *w, const char *path) {
+    size_t len = strlen(path);
+
+    for (int wd = 0; wd < w->dirs_size; wd++) {
+        char *dir_path = w->dirs[wd].path;
+        if (dir_path != NULL && strncmp(dir_path, path, len) == 0 && (dir_path[len] == '\0' || dir_path[len] == '/')) {
+            inotify_rm_watch(w->fd, wd);
+            free(dir_path);
+            w->dirs[wd].path = NULL;
+        }
+    }
+}
+
+
+//builds "dir_path/name" in the watch's path buffer
+static char *event_path(Dwaf_watch *w, const char *dir_path, const char *name) {
+    size_t dir_len = strlen(dir_path), name_len = strlen(name);
+
+    if (dir_len + name_len + 2 > w->path_size) {
+        size_t new_size = (dir_len + name_len + 2) * 2;
+        char *grown;
+        if ((grown = realloc(w->path, new_size)) == NULL) {
+            return NULL;
+        }
+        w->path = grown;
+        w->path_size = new_size;
+    }
+    memcpy(w->path, dir_path, dir_len);
+    w->path[dir_len] = '/';
+    memcpy(w->path + dir_len + 1, name, name_len + 1);
+    return w->path;
+}
+
+
+/**
+ * Handles one event of a watched directory: tells the user what changed,
+ * and traverses and watches directories that were created or moved in.
+ *
+ * @param w watch
+ * @param event event as read from inotify
+ * @return int 0 on success, anything else indicates an error
+ */
+static int handle_event(Dwaf_watch *w, struct inotify_event *event) {
+    Watched_dir *dir;
+    Dwaf_entry entry;
+    char *path;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+        fprintf(stderr, "do-with-all-files: changes were lost, the watched files are no longer current\n");
+        return FAILURE;
+    }
+    if (event->wd < 0 || event->wd >= w->dirs_size || (dir = &w->dirs[event->wd])->path == NULL) {
+        return SUCCESS;                     //directory was forgotten while its events were queued
+    }
+    if (event->mask & IN_IGNORED) {
+        free(dir->path);
+        dir->path = NULL;
+        return SUCCESS;
+    }
+    if (event->len == 0 || (w->config.filter != NULL && filter_skips_name(w->config.filter, event->name, 
+                                (event->mask & IN_ISDIR) ? DT_DIR : DT_UNKNOWN, dir->depth + 1))) {
+        return SUCCESS;
+    }
+    if ((path = event_path(w, dir->path, event->name)) == NULL) {
+        fprintf(stderr, "do-with-all-files: can not handle change in '%s'\n", dir->path);
+        return FAILURE;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    entry.path = path;
+    entry.name_offset = 0;
+    entry.parent_fd = AT_FDCWD;
+    entry.depth = dir->depth + 1;
+    entry.root_index = dir->root_index;
+    entry.d_type = (event->mask & IN_ISDIR) ? DT_DIR : DT_UNKNOWN;
+
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (event->mask & IN_ISDIR) {
+            forget_subtree(w, path);
+        }
+        w->do_with_change(&entry, DWAF_DELETED, w->arg);
+        return SUCCESS;
+    }
+    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR)) {
+        Watch_scan scan = {.w = w, .change = DWAF_CREATED, .depth_offset = entry.depth, .root_index = entry.root_index};
+        char *files[1];
+        int status;
+        if ((files[0] = strdup(path)) == NULL) {
+            return FAILURE;
+        }
+        status = traverse_and_watch(w, files, 1, &scan);
+        free(files[0]);
+        return status;
+    }
+
+    if (statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, w->config.statx_mask | STATX_TYPE
+                | (w->config.filter != NULL ? filter_statx_mask(w->config.filter) : 0), &entry.stx) < 0) {
+        return SUCCESS;                     //gone again, its deletion is the next event
+    }
+    entry.stx_mask = entry.stx.stx_mask;
+    if (entry.stx_mask & STATX_TYPE) {
+        entry.d_type = IFTODT(entry.stx.stx_mode);
+    }
+    if (w->config.filter != NULL && filter_skips_entry(w->config.filter, event->name, &entry)) {
+        return SUCCESS;
+    }
+    w->do_with_change(&entry, (event->mask & (IN_CREATE | IN_MOVED_TO)) ? DWAF_CREATED : DWAF_MODIFIED, w->arg);
+    return SUCCESS;
+}
+
+
+Dwaf_watch *dwaf_watch_create(void (*do_with_change)(Dwaf_entry *entry, int change, void *arg), void *arg,
+                        char **files, int files_size, int num_threads, const Dwaf_config *config) {
+    Dwaf_watch *w;
+    Watch_scan scan;
+
+    if (do_with_change == NULL || (w = calloc(1, sizeof(Dwaf_watch))) == NULL) {
+        return NULL;
+    }
+    w->fd = -1;
+    w->do_with_change = do_with_change;
+    w->arg = arg;
+    if (config != NULL) {
+        w->config = *config;
+    }
+    w->config.do_with_batch = NULL;             //entries go through watch_entry one by one
+    if (pthread_mutex_init(&w->lock, NULL) != 0) {
+        free(w);
+        return NULL;
+    }
+    if ((w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0
+            || (w->events = malloc(EVENT_BUF_SIZE)) == NULL
+            || (w->ctx = dwaf_context_create(num_threads)) == NULL) {
+        fprintf(stderr, "do-with-all-files: can not watch files\n");
+        dwaf_watch_destroy(w);
+        return NULL;
+    }
+
+    scan.w = w;
+    scan.change = DWAF_FOUND;
+    scan.depth_offset = 0;
+    scan.root_index = -1;
+    if (traverse_and_watch(w, files, files_size, &scan) != SUCCESS || w->failed) {
+        fprintf(stderr, "do-with-all-files: error traversing files to watch\n");
+        dwaf_watch_destroy(w);
+        return NULL;
+    }
+    w->config.root_done = NULL;                 //only for the first traversal
+    w->config.cache_path = NULL;
+    w->config.stats = NULL;
+    w->config.trace_path = NULL;
+    return w;
+}
+
+
+int dwaf_watch_fd(Dwaf_watch *w) {
+    return w->fd;
+}
+
+
+int dwaf_watch_poll(Dwaf_watch *w, int timeout_ms) {
+    struct pollfd pfd = {.fd = w->fd, .events = POLLIN};
+    int status = SUCCESS;
+    ssize_t read_bytes;
+
+    if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+        return FAILURE;
+    }
+    //events are read until none are left, so a burst of changes is handled in one call
+    while ((read_bytes = read(w->fd, w->events, EVENT_BUF_SIZE)) > 0) {
+        struct inotify_event *last = NULL;
+        for (char *p = w->events; p < w->events + read_bytes; ) {
+            struct inotify_event *event = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            //writes in a row to the same file are told once
+            if (last != NULL && (event->mask & IN_MODIFY) && last->mask == event->mask && last->wd == event->wd
+                    && last->len == event->len && strcmp(last->name, event->name) == 0) {
+                continue;
+            }
+            last = event;
+            if (handle_event(w, event) != SUCCESS) {
+                status = FAILURE;
+            }
+        }
+    }
+    if (read_bytes < 0 && errno != EAGAIN && errno != EINTR) {
+        status = FAILURE;
+    }
+    if (w->failed) {
+        w->failed = false;
+        status = FAILURE;
+    }
+    return status;
+}
+
+
+void dwaf_watch_destroy(Dwaf_watch *w) {
+    if (w == NULL) {
+        return;
+    }
+    if (w->ctx != NULL) {
+        dwaf_context_destroy(w->ctx);
+    }
+    if (w->fd >= 0) {
+        close(w->fd);
+    }
+    for (int wd = 0; wd < w->dirs_size; wd++) {
+        free(w->dirs[wd].path);
+    }
+    free(w->dirs);
+    free(w->events);
+    free(w->path);
+    pthread_mutex_destroy(&w->lock);
+    free(w);
+}
@@ -0,0 +1,188 @@
+#include "work_deque.h"
+#include <stdlib.h>
+#include <time.h>
+
+static _Thread_local unsigned long long lock_wait_ns;      //time the calling thread was blocked on deque locks
+
+
+Work_deque *work_deque_create(void)
+{
+    Work_deque *dq;
+    if ((dq = calloc(1, sizeof(Work_deque))) == NULL) {
+        return NULL;
+    }
+    if ((dq->items = malloc(WORK_DEQUE_INITIAL_CAPACITY * sizeof(Work_item*))) == NULL) {
+        free(dq);
+        return NULL;
+    }
+    if (pthread_mutex_init(&dq->lock, NULL) != 0) {
+        free(dq->items);
+        free(dq);
+        return NULL;
+    }
+    dq->capacity = WORK_DEQUE_INITIAL_CAPACITY;
+    dq->top = 0;
+    dq->bottom = 0;
+    atomic_init(&dq->size, 0);
+
+    return dq;
+}
+
+
+void work_deque_destroy(Work_deque *dq)
+{
+    pthread_mutex_destroy(&dq->lock);
+    free(dq->items);
+    free(dq);
+}
+
+
+//locks the deque, timing the wait only when another thread holds the lock, so the uncontended case costs no clock reads
+static void lock_deque(Work_deque *dq)
+{
+    struct timespec start, end;
+
+    if (pthread_mutex_trylock(&dq->lock) == 0) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&dq->lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lock_wait_ns += (unsigned long long)((end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec));
+}
+
+
+//makes room for n more items, must hold the lock
+static bool reserve(Work_deque *dq, size_t n)
+{
+    size_t used = dq->bottom - dq->top;
+    size_t new_capacity = dq->capacity;
+    Work_item **grown;
+
+    if (used + n <= dq->capacity) {
+        return true;
+    }
+    while (used + n > new_capacity) {
+        new_capacity *= 2;
+    }
+    if ((grown = malloc(new_capacity * sizeof(Work_item*))) == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < used; i++) {
+        grown[i] = dq->items[(dq->top + i) & (dq->capacity - 1)];
+    }
+    free(dq->items);
+    dq->items = grown;
+    dq->capacity = new_capacity;
+    dq->top = 0;
+    dq->bottom = used;
+    return true;
+}
+
+
+bool work_deque_push(Work_deque *dq, Work_item *item)
+{
+    return work_deque_push_batch(dq, &item, 1);
+}
+
+
+bool work_deque_push_batch(Work_deque *dq, Work_item **items, int n)
+{
+    lock_deque(dq);
+    if (!reserve(dq, (size_t)n)) {
+        pthread_mutex_unlock(&dq->lock);
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        dq->items[dq->bottom++ & (dq->capacity - 1)] = items[i];
+    }
+    atomic_fetch_add_explicit(&dq->size, n, memory_order_release);
+    pthread_mutex_unlock(&dq->lock);
+    return true;
+}
+
+
+Work_item *work_deque_pop(Work_deque *dq)
+{
+    Work_item *item;
+
+    return work_deque_pop_batch(dq, &item, 1) == 1 ? item : NULL;
+}
+
+
+int work_deque_pop_batch(Work_deque *dq, Work_item **items, int max)
+{
+    int n = 0;
+
+    if (work_deque_is_empty(dq)) {
+        return 0;
+    }
+
+    lock_deque(dq);
+    while (n < max && dq->bottom != dq->top) {
+        items[n++] = dq->items[--dq->bottom & (dq->capacity - 1)];
+    }
+    atomic_fetch_sub_explicit(&dq->size, n, memory_order_relaxed);
+    pthread_mutex_unlock(&dq->lock);
+
+    return n;
+}
+
+
+int work_deque_pop_oldest_batch(Work_deque *dq, Work_item **items, int max)
+{
+    int n = 0;
+
+    if (work_deque_is_empty(dq)) {
+        return 0;
+    }
+
+    lock_deque(dq);
+    while (n < max && dq->bottom != dq->top) {
+        items[n++] = dq->items[dq->top++ & (dq->capacity - 1)];
+    }
+    atomic_fetch_sub_explicit(&dq->size, n, memory_order_relaxed);
+    pthread_mutex_unlock(&dq->lock);
+
+    return n;
+}
+
+
+Work_item *work_deque_steal(Work_deque *dq)
+{
+    Work_item *item;
+
+    return work_deque_steal_batch(dq, &item, 1) == 1 ? item : NULL;
+}
+
+
+int work_deque_steal_batch(Work_deque *dq, Work_item **items, int max)
+{
+    int n = 0, half;
+
+    if (work_deque_is_empty(dq)) {
+        return 0;
+    }
+
+    lock_deque(dq);
+    half = (int)((dq->bottom - dq->top + 1) / 2);
+    while (n < max && n < half) {
+        items[n++] = dq->items[dq->top++ & (dq->capacity - 1)];
+    }
+    atomic_fetch_sub_explicit(&dq->size, n, memory_order_relaxed);
+    pthread_mutex_unlock(&dq->lock);
+
+    return n;
+}
+
+
+bool work_deque_is_empty(Work_deque *dq)
+{
+    return atomic_load_explicit(&dq->size, memory_order_acquire) == 0;
+}
+
+
+unsigned long long work_deque_lock_wait_ns(void)
+{
+    return lock_wait_ns;
+}
@@ -0,0 +1,162 @@
+#ifndef WORK_DEQUE_H
+#define WORK_DEQUE_H
+
+/**
+ * @defgroup work_deque_h Work deque
+ *
+ * @brief This module is used to hold the pending work of one worker thread.
+ *
+ * Each worker owns one deque. The owner pushes at the bottom and
+ * pops there (newest work first), or at the top (oldest work first)
+ * for a breadth-first order, while other workers steal from the top
+ * when their own deque has run dry. Every deque
+ * has its own lock, so workers only contend when stealing.
+ *
+ * The deque is a growable ring buffer of pointers to work items, and
+ * work can be pushed, popped and stolen in batches, so moving many
+ * items costs one lock round-trip. Items are allocated, and given
+ * back, by the user.
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WORK_DEQUE_INITIAL_CAPACITY 64
+
+
+/**
+ * The type for one item of work: a path and a pointer handed back
+ * as is together with it.
+*/
+typedef struct work_item
+{
+    void *data;
+    char path[];
+} Work_item;
+
+
+/**
+ * The type for the work deque.
+*/
+typedef struct work_deque
+{
+    Work_item **items;          //ring buffer, capacity is a power of two
+    size_t capacity;
+    size_t top;                 //position of oldest work, only ever grows
+    size_t bottom;              //position after newest work, only ever grows
+    atomic_int size;            //read without the lock by would-be thieves
+    pthread_mutex_t lock;
+} Work_deque;
+
+
+/**
+ * @brief Create and return an empty work deque.
+ *
+ * @return           Work_deque pointer to the created deque, NULL on failure.
+ */
+Work_deque *work_deque_create(void);
+
+
+/**
+ * @brief Destroys work deque. Work left in it is not given back.
+ *
+ * @param dq         Work_deque pointer to deque to be destroyed.
+ */
+void work_deque_destroy(Work_deque *dq);
+
+
+/**
+ * @brief Pushes work to the bottom of the deque (owner only).
+ *
+ * @param dq         Work_deque pointer to deque to push to.
+ * @param item       Work_item pointer to work.
+ * @return           true on success, false if the deque could not grow.
+ */
+bool work_deque_push(Work_deque *dq, Work_item *item);
+
+
+/**
+ * @brief Pushes several items of work to the bottom of the deque (owner only).
+ *
+ * The last item of the array ends up at the bottom.
+ *
+ * @param dq         Work_deque pointer to deque to push to.
+ * @param items      array of Work_item pointers to work.
+ * @param n          number of items.
+ * @return           true on success, false if the deque could not grow.
+ */
+bool work_deque_push_batch(Work_deque *dq, Work_item **items, int n);
+
+
+/**
+ * @brief Pops the newest work from the bottom of the deque (owner only).
+ *
+ * @param dq         Work_deque pointer to deque to pop from.
+ * @return           Work_item pointer to work, NULL if deque is empty.
+ */
+Work_item *work_deque_pop(Work_deque *dq);
+
+
+/**
+ * @brief Pops up to max items of the newest work (owner only).
+ *
+ * @param dq         Work_deque pointer to deque to pop from.
+ * @param items      array filled with popped work, newest first.
+ * @param max        size of items.
+ * @return           number of popped items.
+ */
+int work_deque_pop_batch(Work_deque *dq, Work_item **items, int max);
+
+
+/**
+ * @brief Pops up to max items of the oldest work from the top (owner only).
+ *
+ * @param dq         Work_deque pointer to deque to pop from.
+ * @param items      array filled with popped work, oldest first.
+ * @param max        size of items.
+ * @return           number of popped items.
+ */
+int work_deque_pop_oldest_batch(Work_deque *dq, Work_item **items, int max);
+
+
+/**
+ * @brief Steals the oldest work from the top of the deque.
+ *
+ * @param dq         Work_deque pointer to deque to steal from.
+ * @return           Work_item pointer to work, NULL if deque is empty.
+ */
+Work_item *work_deque_steal(Work_deque *dq);
+
+
+/**
+ * @brief Steals up to half of the deque's work, but at most max items.
+ *
+ * @param dq         Work_deque pointer to deque to steal from.
+ * @param items      array filled with stolen work, oldest first.
+ * @param max        size of items.
+ * @return           number of stolen items.
+ */
+int work_deque_steal_batch(Work_deque *dq, Work_item **items, int max);
+
+
+/**
+ * @brief Checks, without locking, if deque looks empty.
+ *
+ * @param dq         Work_deque pointer to deque to be checked.
+ * @return           Boolean true if deque seemed empty when checked.
+ */
+bool work_deque_is_empty(Work_deque *dq);
+
+
+/**
+ * @brief Returns how long the calling thread has been blocked on the
+ *        locks of any deque, added up since the thread started.
+ *
+ * @return           time in nanoseconds.
+ */
+unsigned long long work_deque_lock_wait_ns(void);
+
+#endif /* WORK_DEQUE_H */